@@ -0,0 +1,57 @@
+/***************************************************************************
+ *
+ *  Copyright (C) 2017 Codeplay Software Limited
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  For your convenience, a copy of the License has been included in this
+ *  repository.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  Codeplay's ComputeCpp SDK
+ *
+ *  benchmark.hpp
+ *
+ *  Description:
+ *    Device selection shared by the benchmarks, which time their kernels on
+ *    the host and CPU devices.
+ *
+ **************************************************************************/
+
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <CL/sycl.hpp>
+
+#include <iostream>
+#include <string>
+
+/* Selects a device with `selector`, prints its name after `label` and calls
+ * `fn` with a queue on it, which times and prints the workload of the
+ * benchmark. Prints that the device is not available if there is none. */
+template <typename F>
+void time_on(const std::string& label,
+             const cl::sycl::device_selector& selector, F fn) {
+  cl::sycl::device device;
+  try {
+    device = selector.select_device();
+  } catch (cl::sycl::exception ex) {
+    std::cout << label << ": not available\n";
+    return;
+  }
+
+  cl::sycl::queue q(device);
+  std::cout << label << ": "
+            << device.get_info<cl::sycl::info::device::name>() << '\n';
+  fn(q);
+}
+
+#endif  // BENCHMARK_HPP
@@ -0,0 +1,96 @@
+/***************************************************************************
+ *
+ *  Copyright (C) 2016 Codeplay Software Limited
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  For your convenience, a copy of the License has been included in this
+ *  repository.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  Codeplay's ComputeCpp SDK
+ *
+ *  deterministic_benchmark.cpp
+ *
+ *  Description:
+ *    Compares the default reduction of reduction.hpp with the deterministic
+ *    and the compensated modes, in time and in accuracy.
+ *
+ **************************************************************************/
+
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "reduction.hpp"
+
+
+/* Runs `iterations` calls of f and returns the average time per call in
+ * milliseconds. The result of the last call is stored in result. */
+template <typename F>
+double time_mode(F f, int iterations, float& result){
+    /* The first run builds the kernels and is not timed. */
+    result = f();
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; i++)    result = f();
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+
+void report(const std::string& label, double ms, float result, long double exact){
+    std::cout << "  " << label << ms << " ms, relative error "
+              << std::fabs(static_cast<double>((result - exact) / exact)) << '\n';
+}
+
+
+/* usage: ./deterministic_benchmark [elements] [iterations] */
+int main(int argc, char* argv[]){
+    size_t N = (argc > 1) ? std::stoul(argv[1]) : 65536u;
+    int iterations = (argc > 2) ? std::stoi(argv[2]) : 5;
+
+    /* Values of very different magnitudes make the order of the additions
+     * visible in the result. */
+    std::mt19937 rand(42);
+    std::uniform_real_distribution<float> mantissa(1.0f, 2.0f);
+    std::uniform_int_distribution<int> exponent(-10, 10);
+
+    std::vector<float> v(N);
+    for(auto& x : v)    x = std::ldexp(mantissa(rand), exponent(rand));
+
+    long double exact = 0;
+    for(float x : v)    exact += x;
+
+    cl::sycl::queue q = chiu::reduction_queue();
+    std::cout << "Device: " << q.get_device().get_info<cl::sycl::info::device::name>() << '\n';
+    std::cout << "Elements: " << N << ", iterations: " << iterations << '\n';
+
+    chiu::reducer<float, std::plus<float>> sum(q);
+    float result;
+
+    /* reduce() would send short inputs to the host, so the baseline calls
+     * the device reduction directly. */
+    double ms = time_mode([&]{ return sum.reduce_on_device(v, 0.0f); }, iterations, result);
+    report("default:       ", ms, result, exact);
+
+    ms = time_mode([&]{ return chiu::deterministic_reduce(q, v, 0.0f, std::plus<float>{}); }, iterations, result);
+    report("deterministic: ", ms, result, exact);
+
+    ms = time_mode([&]{ return chiu::compensated_sum(q, v, 0.0f); }, iterations, result);
+    report("compensated:   ", ms, result, exact);
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+/***************************************************************************
+ *
+ *  Copyright (C) 2016 Codeplay Software Limited
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  For your convenience, a copy of the License has been included in this
+ *  repository.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  Codeplay's ComputeCpp SDK
+ *
+ *  extrema.hpp
+ *
+ *  Description:
+ *    Minimum and maximum operators shared by the reductions and the scans.
+ *
+ **************************************************************************/
+
+#ifndef EXTREMA_HPP
+#define EXTREMA_HPP
+
+#include <limits>
+
+namespace chiu{
+
+    /* Binary operators for the smallest and the largest element. Their
+     * identity is an infinity of T if it has one and the most extreme finite
+     * value of T otherwise. */
+    template <typename T>
+    struct minimum{
+        static constexpr T identity = std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity()
+                                                                          : std::numeric_limits<T>::max();
+
+        T operator()(T a, T b) const{ return b < a ? b : a; }
+    };
+
+    template <typename T>
+    struct maximum{
+        static constexpr T identity = std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity()
+                                                                          : std::numeric_limits<T>::lowest();
+
+        T operator()(T a, T b) const{ return a < b ? b : a; }
+    };
+}
+
+#endif  // EXTREMA_HPP
@@ -25,18 +25,24 @@
  *
  **************************************************************************/
 
-/*  This example compares an OpenMP blocked matrix multiplication
- *  implementation with a SYCL blocked matrix multiplication example.
- *  The purpose is not to compare performance, but to show the similarities
- *  and differences between them.
- *  See block_host for the OpenMP implementation. */
+/*  This example compares a host matrix multiplication, packed, vectorized
+ *  and spread over host threads, with SYCL blocked matrix multiplication
+ *  kernels, to show the similarities and differences between them and to
+ *  give the kernels a fair host baseline.
+ *  See host_gemm for the host implementation. */
 
 #include <CL/sycl.hpp>
 
 #include <chrono>
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstring>
 #include <ctime>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 
 using namespace cl::sycl;
 
@@ -58,31 +64,194 @@ void display_matrix(float* m, int matSize) {
   ;
 }
 
-/* Implements a host C++ version of the matrix multiplication.
- * If compiler supports OpenMP, code is parallelized. Scheduling
- * uses static chunks of block_size. */
-void block_host(float* MA, float* MB, float* MC, int matSize) {
-  /* We set the block size to 32 for simplicity, though the optimal
-   * value will depend on the platform this is run on. */
-  int block_size = 32;
-  int numBlocks = block_size / matSize;
-  int extraBlockLength = block_size % matSize;
-  numBlocks = extraBlockLength ? (numBlocks + 1) : (numBlocks);
+/* Blocking of the host GEMM. A micro-kernel computes an MR x NR block of C
+ * in registers, NR being two SIMD vectors. Panels of KC columns of A and KC
+ * rows of B are packed, B in blocks of NC columns, which stay in the
+ * last-level cache, and A in blocks of MC rows, which stay in L2. */
+constexpr int hostMR = 6;
+constexpr int hostMC = 96;
+constexpr int hostKC = 256;
+constexpr int hostNC = 2048;
 
-#pragma omp parallel for collapse(2)
-  for (int bIndexI = 0; bIndexI < matSize; bIndexI += block_size)
-    for (int bIndexJ = 0; bIndexJ < matSize; bIndexJ += block_size)
-      for (int bIndexK = 0; bIndexK < matSize; bIndexK += block_size) {
-        int i = bIndexI;
-        int j = bIndexJ;
-        int k = bIndexK;
-        for (int bi = i; bi < std::min(i + block_size, matSize); bi++)
-          for (int bj = j; bj < std::min(j + block_size, matSize); bj++)
-            for (int bk = k; bk < std::min(k + block_size, matSize); bk++) {
-              MC[bi * matSize + bj] +=
-                  MA[bi * matSize + bk] * MB[bk * matSize + bj];
+/* Size of the SIMD vectors of the host GEMM: AVX registers if the compiler
+ * targets them, SSE or NEON ones otherwise. Twelve accumulators and three
+ * operands then fit in the sixteen registers. */
+#if defined(__AVX__)
+constexpr int hostVecBytes = 32;
+#else
+constexpr int hostVecBytes = 16;
+#endif
+
+// SIMD vector of T, using the GCC and Clang vector extensions
+template <typename T>
+struct host_vec {
+  typedef T type __attribute__((vector_size(hostVecBytes)));
+  static constexpr int width = hostVecBytes / sizeof(T);
+  static constexpr int NR = 2 * width;
+};
+
+/* Packs the kc x nc block of op(B) starting at row k0, column j0 into slivers
+ * of NR columns, each stored row by row, so the micro-kernel reads it
+ * contiguously. Columns past nc are zero. */
+template <typename T>
+void pack_b(bool transB, const T* B, int ldb, int k0, int j0, int kc, int nc,
+            T* packed) {
+  constexpr int NR = host_vec<T>::NR;
+  for (int jr = 0; jr < nc; jr += NR) {
+    for (int k = 0; k < kc; k++) {
+      for (int j = 0; j < NR; j++) {
+        int col = j0 + jr + j;
+        T value = 0;
+        if (jr + j < nc) {
+          value = transB ? B[size_t(col) * ldb + k0 + k]
+                         : B[size_t(k0 + k) * ldb + col];
+        }
+        *packed++ = value;
+      }
+    }
+  }
+}
+
+/* Packs the mc x kc block of op(A) starting at row i0, column k0 into slivers
+ * of MR rows, each stored column by column. Rows past mc are zero. */
+template <typename T>
+void pack_a(bool transA, const T* A, int lda, int i0, int k0, int mc, int kc,
+            T* packed) {
+  for (int ir = 0; ir < mc; ir += hostMR) {
+    for (int k = 0; k < kc; k++) {
+      for (int i = 0; i < hostMR; i++) {
+        int row = i0 + ir + i;
+        T value = 0;
+        if (ir + i < mc) {
+          value = transA ? A[size_t(k0 + k) * lda + row]
+                         : A[size_t(row) * lda + k0 + k];
+        }
+        *packed++ = value;
+      }
+    }
+  }
+}
+
+/* Computes the MR x NR product of a packed sliver of A and one of B over kc
+ * and stores alpha times it plus beta times C into the m x n corner of the
+ * block at C, which is all of it except at the edges of C. Every row of the
+ * block is held in two SIMD vectors, updated with the broadcast element of A
+ * and the two vectors of the row of B for every k. */
+template <typename T>
+void micro_kernel(int kc, const T* packedA, const T* packedB, T alpha, T beta,
+                  T* C, int ldc, int m, int n) {
+  typedef typename host_vec<T>::type vec;
+  constexpr int width = host_vec<T>::width;
+  constexpr int NR = host_vec<T>::NR;
+
+  vec acc[hostMR][2];
+  for (int i = 0; i < hostMR; i++) {
+    acc[i][0] = vec{};
+    acc[i][1] = vec{};
+  }
+
+  for (int k = 0; k < kc; k++) {
+    vec b0;
+    vec b1;
+    std::memcpy(&b0, packedB + k * NR, sizeof(vec));
+    std::memcpy(&b1, packedB + k * NR + width, sizeof(vec));
+    for (int i = 0; i < hostMR; i++) {
+      T a = packedA[k * hostMR + i];
+      acc[i][0] += a * b0;
+      acc[i][1] += a * b1;
+    }
+  }
+
+  T result[hostMR][NR];
+  std::memcpy(result, acc, sizeof(result));
+  for (int i = 0; i < m; i++) {
+    for (int j = 0; j < n; j++) {
+      T value = alpha * result[i][j];
+      if (beta != T(0)) {
+        value += beta * C[size_t(i) * ldc + j];
+      }
+      C[size_t(i) * ldc + j] = value;
+    }
+  }
+}
+
+/* Host version of gemm, with the same arguments apart from the queue, used as
+ * the baseline of the SYCL kernels and as their fallback. Follows the
+ * structure of GotoBLAS: op(B) is packed in blocks of KC x NC and op(A) in
+ * blocks of MC x KC, so the SIMD micro-kernel streams both from cache in the
+ * order it reads them. The blocks of A are handed out to one std::thread per
+ * hardware thread, which share the packed block of B. */
+template <typename T>
+void host_gemm(bool transA, bool transB, int M, int N, int K, T alpha,
+               const T* A, int lda, const T* B, int ldb, T beta, T* C,
+               int ldc) {
+  if (M <= 0 || N <= 0) {
+    return;
+  }
+  if (K <= 0) {
+    for (int i = 0; i < M; i++) {
+      for (int j = 0; j < N; j++) {
+        T& c = C[size_t(i) * ldc + j];
+        c = (beta != T(0)) ? beta * c : T(0);
+      }
+    }
+    return;
+  }
+
+  constexpr int NR = host_vec<T>::NR;
+  std::vector<T> packedB(size_t(hostKC) *
+                         ((std::min(N, hostNC) + NR - 1) / NR) * NR);
+  int blocksA = (M + hostMC - 1) / hostMC;
+  int threads = std::min<int>(
+      std::max(1u, std::thread::hardware_concurrency()), blocksA);
+
+  for (int jc = 0; jc < N; jc += hostNC) {
+    int nc = std::min(hostNC, N - jc);
+    for (int pc = 0; pc < K; pc += hostKC) {
+      int kc = std::min(hostKC, K - pc);
+      pack_b(transB, B, ldb, pc, jc, kc, nc, packedB.data());
+      // Only the first panel of k scales C by beta
+      T betaPanel = (pc == 0) ? beta : T(1);
+
+      // Every thread takes the next block of A until none are left
+      std::atomic<int> nextBlock(0);
+      auto multiplyBlocks = [&]() {
+        std::vector<T> packedA(size_t(kc) *
+                               ((hostMC + hostMR - 1) / hostMR) * hostMR);
+        for (int b = nextBlock++; b < blocksA; b = nextBlock++) {
+          int ic = b * hostMC;
+          int mc = std::min(hostMC, M - ic);
+          pack_a(transA, A, lda, ic, pc, mc, kc, packedA.data());
+
+          for (int jr = 0; jr < nc; jr += NR) {
+            for (int ir = 0; ir < mc; ir += hostMR) {
+              micro_kernel(kc, packedA.data() + size_t(ir) * kc,
+                           packedB.data() + size_t(jr) * kc, alpha,
+                           betaPanel, C + size_t(ic + ir) * ldc + jc + jr,
+                           ldc, std::min(hostMR, mc - ir),
+                           std::min(NR, nc - jr));
             }
+          }
+        }
+      };
+
+      std::vector<std::thread> workers;
+      for (int t = 1; t < threads; t++) {
+        workers.emplace_back(multiplyBlocks);
+      }
+      multiplyBlocks();
+      for (auto& w : workers) {
+        w.join();
       }
+    }
+  }
+}
+
+/* Host version of the matrix multiplication, adding MA * MB to MC. Runs
+ * host_gemm on all hardware threads. */
+void block_host(float* MA, float* MB, float* MC, int matSize) {
+  host_gemm<float>(false, false, matSize, matSize, matSize, 1.0f, MA, matSize,
+                   MB, matSize, 1.0f, MC, matSize);
 }
 
 /* Obtains the previous power of two from the given integer.
@@ -212,15 +381,795 @@ bool local_mxm(cl::sycl::queue& q, T* MA, T* MB, T* MC, int matSize) {
   return false;
 }
 
+class mxm_prefetch_kernel;
+
+/* Pipelined version of local_mxm. local_mxm loads a block of A and B,
+ * synchronizes, computes and synchronizes again, so no load overlaps with
+ * the computation. Here the blocks alternate between two local buffers:
+ * while computing on one block, every work-item loads its elements of the
+ * next one from global memory into registers, and stores them into the other
+ * buffer once it has finished computing. A single barrier per block then
+ * both publishes the next block and guarantees that nobody reads the current
+ * one any longer, since it is only overwritten after the following barrier.
+ * Like local_mxm, this only works for powers of two. */
+template <typename T>
+bool local_mxm_prefetch(cl::sycl::queue& q, T* MA, T* MB, T* MC,
+                        int matSize) {
+  // Make sure it is power of two before running
+  if (!isPowerOfTwo(matSize)) {
+    std::cout << " This example only works with power of two sizes "
+              << std::endl;
+    return true;
+  }
+
+  auto device = q.get_device();
+  auto maxBlockSize =
+      device.get_info<cl::sycl::info::device::max_work_group_size>();
+  int blockSize = prevPowerOfTwo(std::sqrt(maxBlockSize));
+  // Make sure the block size is not larger than the mat size
+  blockSize = std::min(matSize, blockSize);
+
+  {
+    range<1> dimensions(matSize * matSize);
+    const property_list props = {property::buffer::use_host_ptr()};
+    buffer<T> bA(MA, dimensions, props);
+    buffer<T> bB(MB, dimensions, props);
+    buffer<T> bC(MC, dimensions, props);
+
+    q.submit([&](handler& cgh) {
+      auto pA = bA.template get_access<access::mode::read>(cgh);
+      auto pB = bB.template get_access<access::mode::read>(cgh);
+      auto pC = bC.template get_access<access::mode::write>(cgh);
+      // Two blocks of A and two of B, one being computed and one loaded
+      auto localRange = range<1>(2 * blockSize * blockSize);
+
+      accessor<T, 1, access::mode::read_write, access::target::local> pBA(
+          localRange, cgh);
+      accessor<T, 1, access::mode::read_write, access::target::local> pBB(
+          localRange, cgh);
+
+      cgh.parallel_for<mxm_prefetch_kernel>(
+          nd_range<2>{range<2>(matSize, matSize),
+                      range<2>(blockSize, blockSize)},
+          [=](nd_item<2> it) {
+            // Current block
+            int blockX = it.get_group(1);
+            int blockY = it.get_group(0);
+
+            // Current local item
+            int localX = it.get_local_id(1);
+            int localY = it.get_local_id(0);
+
+            // Elements of the current item in the global and local blocks
+            int a = matSize * (blockSize * blockY + localY) + localX;
+            int b = matSize * localY + blockSize * blockX + localX;
+            int localA = localY * blockSize + localX;
+            // Note the swap of X/Y to maintain contiguous access
+            int localB = localX * blockSize + localY;
+            int blockElems = blockSize * blockSize;
+            int numBlocks = matSize / blockSize;
+
+            // Copy the first blocks in shared memory collectively
+            pBA[localA] = pA[a];
+            pBB[localB] = pB[b];
+            it.barrier(access::fence_space::local_space);
+
+            // Result for the current C(i,j) element
+            T tmp = 0.0f;
+            for (int block = 0; block < numBlocks; block++) {
+              int current = (block % 2) * blockElems;
+              int next = blockElems - current;
+              bool prefetch = block + 1 < numBlocks;
+
+              // Start loading the next blocks before computing
+              T nextA = 0.0f;
+              T nextB = 0.0f;
+              if (prefetch) {
+                nextA = pA[a + (block + 1) * blockSize];
+                nextB = pB[b + (block + 1) * blockSize * matSize];
+              }
+
+              // Now each thread adds the value of its sum
+              for (int k = 0; k < blockSize; k++) {
+                tmp += pBA[current + localY * blockSize + k] *
+                       pBB[current + localX * blockSize + k];
+              }
+
+              if (prefetch) {
+                pBA[next + localA] = nextA;
+                pBB[next + localB] = nextB;
+              }
+              /* The next blocks are visible to all threads, and the current
+               * ones are only overwritten after the following barrier */
+              it.barrier(access::fence_space::local_space);
+            }
+            auto elemIndex = it.get_global_id(0) * it.get_global_range()[1] +
+                             it.get_global_id(1);
+            // Each thread updates its position
+            pC[elemIndex] = tmp;
+          });
+    });
+  }
+  return false;
+}
+
+template <typename T, int TileM, int TileN>
+class mxm_tiled_kernel;
+
+/* Register-tiled version of local_mxm. Each work-item computes a
+ * TileM x TileN block of C in registers instead of a single element: for
+ * every k it reads TileM values of A and TileN values of B from local memory
+ * and performs TileM * TileN multiply-adds with them, so every value read
+ * from local memory is used TileN or TileM times instead of once.
+ * A work-group of blockSize x blockSize work-items computes a
+ * (blockSize * TileM) x (blockSize * TileN) block of C and walks along k in
+ * steps of blockSize, staging the matching panels of A and B in local
+ * memory. The rows and the columns of the block of a work-item are blockSize
+ * apart, so neighbouring work-items read neighbouring local memory and write
+ * neighbouring elements of C.
+ * Like local_mxm, this only works for powers of two, and the order must be
+ * at least TileM and TileN. */
+template <typename T, int TileM, int TileN>
+bool local_mxm_tiled(cl::sycl::queue& q, T* MA, T* MB, T* MC, int matSize) {
+  static_assert(TileM > 0 && (TileM & (TileM - 1)) == 0,
+                "TileM must be a power of two");
+  static_assert(TileN > 0 && (TileN & (TileN - 1)) == 0,
+                "TileN must be a power of two");
+
+  // Make sure it is power of two before running
+  if (!isPowerOfTwo(matSize)) {
+    std::cout << " This example only works with power of two sizes "
+              << std::endl;
+    return true;
+  }
+
+  auto device = q.get_device();
+  auto maxBlockSize =
+      device.get_info<cl::sycl::info::device::max_work_group_size>();
+  int blockSize = prevPowerOfTwo(std::sqrt(maxBlockSize));
+  // Make sure the block of C of a work-group is not larger than the matrix
+  blockSize = std::min(blockSize, matSize / std::max(TileM, TileN));
+  if (blockSize == 0) {
+    std::cout << " The matrix is smaller than the tile of a work-item "
+              << std::endl;
+    return true;
+  }
+  int tileRows = blockSize * TileM;
+  int tileCols = blockSize * TileN;
+
+  {
+    range<1> dimensions(matSize * matSize);
+    const property_list props = {property::buffer::use_host_ptr()};
+    buffer<T> bA(MA, dimensions, props);
+    buffer<T> bB(MB, dimensions, props);
+    buffer<T> bC(MC, dimensions, props);
+
+    q.submit([&](handler& cgh) {
+      auto pA = bA.template get_access<access::mode::read>(cgh);
+      auto pB = bB.template get_access<access::mode::read>(cgh);
+      auto pC = bC.template get_access<access::mode::write>(cgh);
+
+      // Panels of blockSize columns of A and blockSize rows of B
+      accessor<T, 1, access::mode::read_write, access::target::local> pBA(
+          range<1>(blockSize * tileRows), cgh);
+      accessor<T, 1, access::mode::read_write, access::target::local> pBB(
+          range<1>(blockSize * tileCols), cgh);
+
+      cgh.parallel_for<mxm_tiled_kernel<T, TileM, TileN>>(
+          nd_range<2>{range<2>(matSize / TileM, matSize / TileN),
+                      range<2>(blockSize, blockSize)},
+          [=](nd_item<2> it) {
+            // Current local item
+            int localX = it.get_local_id(1);
+            int localY = it.get_local_id(0);
+
+            // First row and column of the block of C of the work-group
+            int rowStart = it.get_group(0) * tileRows;
+            int colStart = it.get_group(1) * tileCols;
+
+            // Results for the block of C of the current work-item
+            T acc[TileM][TileN];
+            for (int i = 0; i < TileM; i++) {
+              for (int j = 0; j < TileN; j++) {
+                acc[i][j] = 0;
+              }
+            }
+
+            for (int kStart = 0; kStart < matSize; kStart += blockSize) {
+              /* Copy the panels in local memory collectively. The panel of A
+               * is stored transposed, so that both panels are read along
+               * their rows below. */
+              for (int i = 0; i < TileM; i++) {
+                int row = localY + i * blockSize;
+                pBA[localX * tileRows + row] =
+                    pA[(rowStart + row) * matSize + kStart + localX];
+              }
+              for (int j = 0; j < TileN; j++) {
+                int col = localX + j * blockSize;
+                pBB[localY * tileCols + col] =
+                    pB[(kStart + localY) * matSize + colStart + col];
+              }
+              it.barrier(access::fence_space::local_space);
+
+              // Outer product of a column of A and a row of B for every k
+              for (int k = 0; k < blockSize; k++) {
+                T a[TileM];
+                T b[TileN];
+                for (int i = 0; i < TileM; i++) {
+                  a[i] = pBA[k * tileRows + localY + i * blockSize];
+                }
+                for (int j = 0; j < TileN; j++) {
+                  b[j] = pBB[k * tileCols + localX + j * blockSize];
+                }
+                for (int i = 0; i < TileM; i++) {
+                  for (int j = 0; j < TileN; j++) {
+                    acc[i][j] += a[i] * b[j];
+                  }
+                }
+              }
+              it.barrier(access::fence_space::local_space);
+            }
+
+            for (int i = 0; i < TileM; i++) {
+              for (int j = 0; j < TileN; j++) {
+                int row = rowStart + localY + i * blockSize;
+                int col = colStart + localX + j * blockSize;
+                pC[row * matSize + col] = acc[i][j];
+              }
+            }
+          });
+    });
+  }
+  return false;
+}
+
+template <typename T, int TileM, int TileN>
+class gemm_kernel;
+
+/* Computes C = alpha * op(A) * op(B) + beta * C for batchCount independent
+ * sets of row-major matrices in one launch. Matrix b of A starts strideA
+ * elements after matrix b - 1, and likewise for B and C; see gemm for the
+ * other arguments, which all matrices share.
+ * The kernel is the one of local_mxm_tiled, with TileM x TileN elements of C
+ * per work-item, for any sizes: the panels of a work-group are padded with
+ * zeros past the edges of op(A) and op(B), and only the elements inside C are
+ * written. A panel is loaded with consecutive work-items reading consecutive
+ * elements of A or B, whether or not it is transposed. The first dimension
+ * of the range runs over the batch: when the blocks of a matrix need few
+ * work-items, each work-group computes the same block of several matrices,
+ * with their panels side by side in local memory. */
+template <typename T, int TileM = 4, int TileN = 4>
+void gemm_strided_batched(queue& q, bool transA, bool transB, int M, int N,
+                          int K, T alpha, const T* A, int lda, size_t strideA,
+                          const T* B, int ldb, size_t strideB, T beta, T* C,
+                          int ldc, size_t strideC, int batchCount) {
+  static_assert(TileM > 0 && (TileM & (TileM - 1)) == 0,
+                "TileM must be a power of two");
+  static_assert(TileN > 0 && (TileN & (TileN - 1)) == 0,
+                "TileN must be a power of two");
+
+  if (M <= 0 || N <= 0 || batchCount <= 0) {
+    return;
+  }
+  K = std::max(K, 0);
+
+  /* The kernel needs local memory; run on the host otherwise. Without k
+   * there is nothing to multiply, and A and B may even be null, so C is only
+   * scaled by beta on the host. */
+  auto device = q.get_device();
+  if (K == 0 ||
+      (!device.is_host() &&
+       device.get_info<cl::sycl::info::device::local_mem_type>() ==
+           cl::sycl::info::local_mem_type::none)) {
+    for (int b = 0; b < batchCount; b++) {
+      host_gemm(transA, transB, M, N, K, alpha, A + size_t(b) * strideA, lda,
+                B + size_t(b) * strideB, ldb, beta, C + size_t(b) * strideC,
+                ldc);
+    }
+    return;
+  }
+
+  auto maxBlockSize =
+      device.get_info<cl::sycl::info::device::max_work_group_size>();
+  int blockSize = prevPowerOfTwo(std::sqrt(maxBlockSize));
+  // Do not use larger blocks than the matrix needs
+  while (blockSize > 1 && (blockSize / 2) * TileM >= M &&
+         (blockSize / 2) * TileN >= N) {
+    blockSize /= 2;
+  }
+  int tileRows = blockSize * TileM;
+  int tileCols = blockSize * TileN;
+  int groupsM = (M + tileRows - 1) / tileRows;
+  int groupsN = (N + tileCols - 1) / tileCols;
+
+  /* Fill work-groups of up to 256 work-items with the blocks of several
+   * matrices, as far as their panels fit in local memory and the device
+   * allows that many work-items along the batch. The host device emulates
+   * the barriers of every work-item, so larger work-groups only cost time
+   * there. */
+  int items = blockSize * blockSize;
+  auto maxItemSizes =
+      device.get_info<cl::sycl::info::device::max_work_item_sizes>();
+  int perGroup = std::min<int>(std::min<size_t>(256, maxBlockSize) / items,
+                               batchCount);
+  perGroup = std::min<size_t>(perGroup, maxItemSizes[0]);
+  perGroup = device.is_host() ? 1 : std::max(perGroup, 1);
+  auto localMemSize =
+      device.get_info<cl::sycl::info::device::local_mem_size>();
+  while (perGroup > 1 && size_t(perGroup) * blockSize *
+                                 (tileRows + tileCols) * sizeof(T) >
+                             localMemSize) {
+    perGroup /= 2;
+  }
+  int batchGroups = (batchCount + perGroup - 1) / perGroup;
+
+  // Elements spanned by each matrix, up to the end of its last row
+  int rowsA = transA ? K : M;
+  int rowsB = transB ? N : K;
+  size_t sizeA = rowsA > 0 ? size_t(rowsA - 1) * lda + (transA ? M : K) : 1;
+  size_t sizeB = rowsB > 0 ? size_t(rowsB - 1) * ldb + (transB ? K : N) : 1;
+  size_t sizeC = size_t(M - 1) * ldc + N;
+  sizeA += size_t(batchCount - 1) * strideA;
+  sizeB += size_t(batchCount - 1) * strideB;
+  sizeC += size_t(batchCount - 1) * strideC;
+
+  {
+    const property_list props = {property::buffer::use_host_ptr()};
+    buffer<T> bA(A, range<1>(sizeA), props);
+    buffer<T> bB(B, range<1>(sizeB), props);
+    buffer<T> bC(C, range<1>(sizeC), props);
+
+    q.submit([&](handler& cgh) {
+      auto pA = bA.template get_access<access::mode::read>(cgh);
+      auto pB = bB.template get_access<access::mode::read>(cgh);
+      auto pC = bC.template get_access<access::mode::read_write>(cgh);
+
+      /* Panels of blockSize columns of op(A) and blockSize rows of op(B),
+       * for every matrix of the work-group */
+      accessor<T, 1, access::mode::read_write, access::target::local> pBA(
+          range<1>(perGroup * blockSize * tileRows), cgh);
+      accessor<T, 1, access::mode::read_write, access::target::local> pBB(
+          range<1>(perGroup * blockSize * tileCols), cgh);
+
+      cgh.parallel_for<gemm_kernel<T, TileM, TileN>>(
+          nd_range<3>{range<3>(batchGroups * perGroup, groupsM * blockSize,
+                               groupsN * blockSize),
+                      range<3>(perGroup, blockSize, blockSize)},
+          [=](nd_item<3> it) {
+            // Current local item
+            int localX = it.get_local_id(2);
+            int localY = it.get_local_id(1);
+
+            // Matrix of the batch, which may be past its end
+            size_t batch = it.get_global_id(0);
+            bool inBatch = batch < size_t(batchCount);
+            size_t startA = inBatch ? batch * strideA : 0;
+            size_t startB = inBatch ? batch * strideB : 0;
+            size_t startC = inBatch ? batch * strideC : 0;
+            int slotA = it.get_local_id(0) * blockSize * tileRows;
+            int slotB = it.get_local_id(0) * blockSize * tileCols;
+
+            // First row and column of the block of C of the work-group
+            int rowStart = it.get_group(1) * tileRows;
+            int colStart = it.get_group(2) * tileCols;
+
+            // Results for the block of C of the current work-item
+            T acc[TileM][TileN];
+            for (int i = 0; i < TileM; i++) {
+              for (int j = 0; j < TileN; j++) {
+                acc[i][j] = 0;
+              }
+            }
+
+            for (int kStart = 0; kStart < K; kStart += blockSize) {
+              /* Copy the panels in local memory collectively, with zeros
+               * outside the matrices. Consecutive work-items take
+               * consecutive k in a row-major panel and consecutive rows or
+               * columns in a transposed one. */
+              for (int i = 0; i < TileM; i++) {
+                int row = transA ? localX + i * blockSize
+                                 : localY + i * blockSize;
+                int k = transA ? localY : localX;
+                T value = 0;
+                if (inBatch && rowStart + row < M && kStart + k < K) {
+                  value = transA ? pA[startA + size_t(kStart + k) * lda +
+                                      rowStart + row]
+                                 : pA[startA + size_t(rowStart + row) * lda +
+                                      kStart + k];
+                }
+                pBA[slotA + k * tileRows + row] = value;
+              }
+              for (int j = 0; j < TileN; j++) {
+                int col = transB ? localY + j * blockSize
+                                 : localX + j * blockSize;
+                int k = transB ? localX : localY;
+                T value = 0;
+                if (inBatch && colStart + col < N && kStart + k < K) {
+                  value = transB ? pB[startB + size_t(colStart + col) * ldb +
+                                      kStart + k]
+                                 : pB[startB + size_t(kStart + k) * ldb +
+                                      colStart + col];
+                }
+                pBB[slotB + k * tileCols + col] = value;
+              }
+              it.barrier(access::fence_space::local_space);
+
+              // Outer product of a column of A and a row of B for every k
+              for (int k = 0; k < blockSize; k++) {
+                T a[TileM];
+                T b[TileN];
+                for (int i = 0; i < TileM; i++) {
+                  a[i] = pBA[slotA + k * tileRows + localY + i * blockSize];
+                }
+                for (int j = 0; j < TileN; j++) {
+                  b[j] = pBB[slotB + k * tileCols + localX + j * blockSize];
+                }
+                for (int i = 0; i < TileM; i++) {
+                  for (int j = 0; j < TileN; j++) {
+                    acc[i][j] += a[i] * b[j];
+                  }
+                }
+              }
+              it.barrier(access::fence_space::local_space);
+            }
+
+            for (int i = 0; i < TileM; i++) {
+              for (int j = 0; j < TileN; j++) {
+                int row = rowStart + localY + i * blockSize;
+                int col = colStart + localX + j * blockSize;
+                if (inBatch && row < M && col < N) {
+                  size_t index = startC + size_t(row) * ldc + col;
+                  T result = alpha * acc[i][j];
+                  if (beta != T(0)) {
+                    result += beta * pC[index];
+                  }
+                  pC[index] = result;
+                }
+              }
+            }
+          });
+    });
+  }
+}
+
+/* Computes C = alpha * op(A) * op(B) + beta * C for row-major matrices, where
+ * op(A) is M x K, op(B) is K x N and C is M x N. op(X) is X, or its
+ * transpose if transX is set. lda, ldb and ldc are the distances between the
+ * starts of consecutive rows of A, B and C, so the matrices can be parts of
+ * larger ones. As in BLAS, C is not read if beta is zero. This is a batch of
+ * one for gemm_strided_batched. */
+template <typename T, int TileM = 4, int TileN = 4>
+void gemm(queue& q, bool transA, bool transB, int M, int N, int K, T alpha,
+          const T* A, int lda, const T* B, int ldb, T beta, T* C, int ldc) {
+  gemm_strided_batched<T, TileM, TileN>(q, transA, transB, M, N, K, alpha, A,
+                                        lda, 0, B, ldb, 0, beta, C, ldc, 0, 1);
+}
+
+/* gemm for batchCount sets of matrices given by arrays of pointers to them,
+ * in one launch. The matrices are gathered into contiguous storage for
+ * gemm_strided_batched and the results copied back, since host pointers
+ * cannot be followed on the device. */
+template <typename T, int TileM = 4, int TileN = 4>
+void gemm_batched(queue& q, bool transA, bool transB, int M, int N, int K,
+                  T alpha, const T* const* A, int lda, const T* const* B,
+                  int ldb, T beta, T* const* C, int ldc, int batchCount) {
+  if (M <= 0 || N <= 0 || batchCount <= 0) {
+    return;
+  }
+  K = std::max(K, 0);
+
+  // Stored shapes of the matrices, which are packed without padding
+  int rowsA = transA ? K : M;
+  int colsA = transA ? M : K;
+  int rowsB = transB ? N : K;
+  int colsB = transB ? K : N;
+  size_t strideA = std::max<size_t>(size_t(rowsA) * colsA, 1);
+  size_t strideB = std::max<size_t>(size_t(rowsB) * colsB, 1);
+  size_t strideC = size_t(M) * N;
+
+  std::vector<T> packedA(strideA * batchCount);
+  std::vector<T> packedB(strideB * batchCount);
+  std::vector<T> packedC(strideC * batchCount);
+  for (int b = 0; b < batchCount; b++) {
+    for (int i = 0; i < rowsA; i++) {
+      std::copy(A[b] + size_t(i) * lda, A[b] + size_t(i) * lda + colsA,
+                packedA.begin() + size_t(b) * strideA + size_t(i) * colsA);
+    }
+    for (int i = 0; i < rowsB; i++) {
+      std::copy(B[b] + size_t(i) * ldb, B[b] + size_t(i) * ldb + colsB,
+                packedB.begin() + size_t(b) * strideB + size_t(i) * colsB);
+    }
+    if (beta != T(0)) {
+      for (int i = 0; i < M; i++) {
+        std::copy(C[b] + size_t(i) * ldc, C[b] + size_t(i) * ldc + N,
+                  packedC.begin() + size_t(b) * strideC + size_t(i) * N);
+      }
+    }
+  }
+
+  gemm_strided_batched<T, TileM, TileN>(
+      q, transA, transB, M, N, K, alpha, packedA.data(), colsA, strideA,
+      packedB.data(), colsB, strideB, beta, packedC.data(), N, strideC,
+      batchCount);
+
+  for (int b = 0; b < batchCount; b++) {
+    for (int i = 0; i < M; i++) {
+      std::copy(packedC.begin() + size_t(b) * strideC + size_t(i) * N,
+                packedC.begin() + size_t(b) * strideC + size_t(i + 1) * N,
+                C[b] + size_t(i) * ldc);
+    }
+  }
+}
+
+/* Checks gemm and host_gemm against a naive computation for rectangular
+ * matrices of sizes that are not powers of two, every combination of
+ * transposes, and leading dimensions larger than the rows, including K = 0,
+ * which only scales C. The matrices hold small integers, so the results are
+ * exact. Returns true on error. */
+bool test_gemm(queue& q, int matSize) {
+  const int shapes[][3] = {{1, 1, 1},
+                           {1, 5, 0},
+                           {37, 53, 29},
+                           {100, 7, 130},
+                           {matSize, matSize - 1, matSize + 3}};
+  const float alpha = 2.0f;
+  const float beta = -1.0f;
+
+  for (auto& shape : shapes) {
+    int M = shape[0];
+    int N = shape[1];
+    int K = shape[2];
+    for (int trans = 0; trans < 4; trans++) {
+      bool transA = trans & 1;
+      bool transB = trans & 2;
+      // Stored shapes, with padding at the end of every row
+      int lda = (transA ? M : K) + 3;
+      int ldb = (transB ? K : N) + 1;
+      int ldc = N + 2;
+      std::vector<float> A((transA ? K : M) * lda);
+      std::vector<float> B((transB ? N : K) * ldb);
+      std::vector<float> C(M * ldc);
+      for (size_t i = 0; i < A.size(); i++) {
+        A[i] = static_cast<float>(i * 7 % 5) - 2.0f;
+      }
+      for (size_t i = 0; i < B.size(); i++) {
+        B[i] = static_cast<float>(i * 3 % 7) - 3.0f;
+      }
+      for (size_t i = 0; i < C.size(); i++) {
+        C[i] = static_cast<float>(i % 3);
+      }
+
+      std::vector<float> expected = C;
+      for (int i = 0; i < M; i++) {
+        for (int j = 0; j < N; j++) {
+          float sum = 0.0f;
+          for (int k = 0; k < K; k++) {
+            float a = transA ? A[k * lda + i] : A[i * lda + k];
+            float b = transB ? B[j * ldb + k] : B[k * ldb + j];
+            sum += a * b;
+          }
+          expected[i * ldc + j] = alpha * sum + beta * C[i * ldc + j];
+        }
+      }
+
+      std::vector<float> hostC = C;
+      host_gemm(transA, transB, M, N, K, alpha, A.data(), lda, B.data(), ldb,
+                beta, hostC.data(), ldc);
+      gemm<float>(q, transA, transB, M, N, K, alpha, A.data(), lda, B.data(),
+                  ldb, beta, C.data(), ldc);
+      q.wait_and_throw();
+
+      if (C != expected || hostC != expected) {
+        std::cout << (C != expected ? " gemm" : " host_gemm")
+                  << " with M = " << M << ", N = " << N << ", K = " << K
+                  << (transA ? ", A transposed" : "")
+                  << (transB ? ", B transposed" : "") << " differs"
+                  << std::endl;
+        return true;
+      }
+    }
+    std::cout << " gemm " << M << " x " << N << " x " << K << ": Success"
+              << std::endl;
+  }
+  return false;
+}
+
+/* Checks gemm_strided_batched and gemm_batched against a naive computation
+ * for batches of small matrices with padded rows and strides, and compares
+ * the time of one batched launch with one gemm call per matrix. Returns true
+ * on error. */
+bool test_gemm_batched(queue& q) {
+  const int shapes[][4] = {{16, 16, 16, 1000}, {33, 20, 17, 37}};
+  const float alpha = 2.0f;
+  const float beta = -1.0f;
+
+  for (auto& shape : shapes) {
+    int M = shape[0];
+    int N = shape[1];
+    int K = shape[2];
+    int batchCount = shape[3];
+    bool transA = M != N;
+    // Stored shapes, with padding at the end of every row and matrix
+    int lda = (transA ? M : K) + 1;
+    int ldb = N + 2;
+    int ldc = N + 3;
+    size_t strideA = size_t(transA ? K : M) * lda + 5;
+    size_t strideB = size_t(K) * ldb + 6;
+    size_t strideC = size_t(M) * ldc + 7;
+    std::vector<float> A(strideA * batchCount);
+    std::vector<float> B(strideB * batchCount);
+    std::vector<float> C(strideC * batchCount);
+    for (size_t i = 0; i < A.size(); i++) {
+      A[i] = static_cast<float>(i * 7 % 5) - 2.0f;
+    }
+    for (size_t i = 0; i < B.size(); i++) {
+      B[i] = static_cast<float>(i * 3 % 7) - 3.0f;
+    }
+    for (size_t i = 0; i < C.size(); i++) {
+      C[i] = static_cast<float>(i % 3);
+    }
+
+    std::vector<float> expected = C;
+    for (int b = 0; b < batchCount; b++) {
+      const float* a = A.data() + b * strideA;
+      const float* bm = B.data() + b * strideB;
+      float* c = expected.data() + b * strideC;
+      for (int i = 0; i < M; i++) {
+        for (int j = 0; j < N; j++) {
+          float sum = 0.0f;
+          for (int k = 0; k < K; k++) {
+            sum += (transA ? a[k * lda + i] : a[i * lda + k]) *
+                   bm[k * ldb + j];
+          }
+          c[i * ldc + j] = alpha * sum + beta * c[i * ldc + j];
+        }
+      }
+    }
+
+    // One launch for the strided batch
+    std::vector<float> stridedC = C;
+    auto start = std::chrono::steady_clock::now();
+    gemm_strided_batched<float>(q, transA, false, M, N, K, alpha, A.data(),
+                                lda, strideA, B.data(), ldb, strideB, beta,
+                                stridedC.data(), ldc, strideC, batchCount);
+    auto end = std::chrono::steady_clock::now();
+    double batchedTime =
+        std::chrono::duration<double, std::milli>(end - start).count();
+
+    // The same matrices through arrays of pointers
+    std::vector<const float*> pointersA(batchCount);
+    std::vector<const float*> pointersB(batchCount);
+    std::vector<float*> pointersC(batchCount);
+    std::vector<float> pointerC = C;
+    for (int b = 0; b < batchCount; b++) {
+      pointersA[b] = A.data() + b * strideA;
+      pointersB[b] = B.data() + b * strideB;
+      pointersC[b] = pointerC.data() + b * strideC;
+    }
+    gemm_batched<float>(q, transA, false, M, N, K, alpha, pointersA.data(),
+                        lda, pointersB.data(), ldb, beta, pointersC.data(),
+                        ldc, batchCount);
+
+    // One gemm call per matrix
+    std::vector<float> loopC = C;
+    start = std::chrono::steady_clock::now();
+    for (int b = 0; b < batchCount; b++) {
+      gemm<float>(q, transA, false, M, N, K, alpha, A.data() + b * strideA,
+                  lda, B.data() + b * strideB, ldb, beta,
+                  loopC.data() + b * strideC, ldc);
+    }
+    q.wait_and_throw();
+    end = std::chrono::steady_clock::now();
+    double loopTime =
+        std::chrono::duration<double, std::milli>(end - start).count();
+
+    if (stridedC != expected || pointerC != expected || loopC != expected) {
+      std::cout << " Batch of " << batchCount << " gemm " << M << " x " << N
+                << " x " << K << " differs" << std::endl;
+      return true;
+    }
+    std::cout << " Batch of " << batchCount << " gemm " << M << " x " << N
+              << " x " << K << ": Success, " << batchedTime
+              << " ms batched, " << loopTime << " ms in separate calls"
+              << std::endl;
+  }
+  return false;
+}
+
+/* Runs one of the SYCL kernels on q, then prints its time and GFLOPs and
+ * compares MC with the expected result. Returns true on error. */
+template <typename F>
+bool time_mxm(queue& q, const std::string& name, F mxm, float* MA, float* MB,
+              float* MC, const float* expected, int matSize) {
+  for (int i = 0; i < matSize * matSize; i++) {
+    MC[i] = 0.0f;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  bool error = mxm(q, MA, MB, MC, matSize);
+  q.wait_and_throw();
+  auto end = std::chrono::steady_clock::now();
+  if (error) {
+    return true;
+  }
+
+  double time = std::chrono::duration<double, std::milli>(end - start).count();
+  double flops = 2.0 * matSize * matSize * matSize / (time * 1.0e6);
+  std::cout << " " << name << ": Time: " << time << " ms, GFLOPs: " << flops
+            << std::endl;
+
+  for (int i = 0; i < matSize * matSize; i++) {
+    if (MC[i] != expected[i]) {
+      std::cout << " Position " << i / matSize << ", " << i % matSize
+                << " differs: " << MC[i] << " != " << expected[i] << std::endl;
+      return true;
+    }
+  }
+  return false;
+}
+
+// gemm with the arguments of local_mxm, to compare them
+bool gemm_square(queue& q, float* MA, float* MB, float* MC, int matSize) {
+  gemm<float>(q, false, false, matSize, matSize, matSize, 1.0f, MA, matSize,
+              MB, matSize, 0.0f, MC, matSize);
+  return false;
+}
+
+/* Compares local_mxm with the pipelined and the register-tiled kernels and
+ * gemm for every power of two from 32 up to maxSize. The matrices hold small
+ * integers, so that every kernel computes the exact result of block_host.
+ * Returns true on error. */
+bool compare_kernels(queue& q, int maxSize) {
+  bool error = false;
+  for (int matSize = 32; matSize <= maxSize && !error; matSize *= 2) {
+    std::vector<float> MA(matSize * matSize);
+    std::vector<float> MB(matSize * matSize);
+    std::vector<float> MC(matSize * matSize);
+    std::vector<float> expected(matSize * matSize, 0.0f);
+    for (int i = 0; i < matSize; i++) {
+      for (int j = 0; j < matSize; j++) {
+        MA[i * matSize + j] = static_cast<float>((i * 7 + j * 3) % 5) - 2.0f;
+        MB[i * matSize + j] = static_cast<float>((i * 2 + j * 5) % 7) - 3.0f;
+      }
+    }
+    block_host(MA.data(), MB.data(), expected.data(), matSize);
+
+    std::cout << " ***** Order " << matSize << std::endl;
+    error = error || time_mxm(q, "local_mxm", local_mxm<float>, MA.data(),
+                              MB.data(), MC.data(), expected.data(), matSize);
+    error = error ||
+            time_mxm(q, "local_mxm_prefetch", local_mxm_prefetch<float>,
+                     MA.data(), MB.data(), MC.data(), expected.data(),
+                     matSize);
+    error = error ||
+            time_mxm(q, "local_mxm_tiled<4, 4>", local_mxm_tiled<float, 4, 4>,
+                     MA.data(), MB.data(), MC.data(), expected.data(),
+                     matSize);
+    error = error ||
+            time_mxm(q, "local_mxm_tiled<8, 4>", local_mxm_tiled<float, 8, 4>,
+                     MA.data(), MB.data(), MC.data(), expected.data(),
+                     matSize);
+    error = error || time_mxm(q, "gemm", gemm_square, MA.data(), MB.data(),
+                              MC.data(), expected.data(), matSize);
+  }
+  return error;
+}
+
 /* Helper function to indicate the parameters the sample takes. */
 void usage(std::string programName) {
   std::cout << " Incorrect number of parameters " << std::endl;
   std::cout << " Usage: " << std::endl;
-  std::cout << programName << " [matrix size] [omp|sycl]" << std::endl;
+  std::cout << programName << " [matrix size] [host|sycl|compare|gemm]"
+            << std::endl;
   std::cout << "[matrix size] : Size of the matrix to multiply (minimum 32)"
             << std::endl;
-  std::cout << "[omp|sycl]    : Run the OpenMP or the SYCL variant. "
+  std::cout << "[host|sycl]   : Run the host or the SYCL variant. "
             << " Default is to use both " << std::endl;
+  std::cout << "[compare]     : Compare the SYCL kernels for every power of "
+            << "two up to the matrix size " << std::endl;
+  std::cout << "[gemm]        : Test gemm on rectangular, transposed and "
+            << "strided matrices around the matrix size, and batched gemm "
+            << std::endl;
 }
 
 int main(int argc, char* argv[]) {
@@ -228,7 +1177,9 @@ int main(int argc, char* argv[]) {
   float* MB;
   float* MC;
   bool sycl = true;
-  bool omp = true;
+  bool host = true;
+  bool compare = false;
+  bool testGemm = false;
   bool error = false;
 
   if (argc != 2 && argc != 3) {
@@ -250,14 +1201,25 @@ int main(int argc, char* argv[]) {
   }
 
   if (argc == 3) {
-    if (std::string(argv[2]) == "omp") {
-      omp = true;
+    // omp is the former name of the host mode
+    std::string mode = argv[2];
+    if (mode == "host" || mode == "omp") {
+      host = true;
       sycl = false;
-    } else if (std::string(argv[2]) == "sycl") {
-      omp = false;
+    } else if (mode == "sycl") {
+      host = false;
       sycl = true;
+    } else if (mode == "compare") {
+      host = false;
+      sycl = false;
+      compare = true;
+    } else if (mode == "gemm") {
+      host = false;
+      sycl = false;
+      testGemm = true;
     } else {
       usage(argv[0]);
+      return 1;
     }
   }
 
@@ -282,12 +1244,8 @@ int main(int argc, char* argv[]) {
   display_matrix(MB, matSize);
   display_matrix(MC, matSize);
 
-  if (omp) {
-#if defined(_OPENMP)
-    std::cout << "OpenMP: ";
-#else
-    std::cout << "C++: ";
-#endif
+  if (host) {
+    std::cout << "Host: ";
 
     {
       auto start = std::chrono::steady_clock::now();
@@ -385,6 +1343,38 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  if (compare) {
+    queue q([&](exception_list eL) {
+      try {
+        for (auto& e : eL) {
+          std::rethrow_exception(e);
+        }
+      } catch (cl::sycl::exception e) {
+        std::cout << " An exception has been thrown: " << e.what()
+                  << std::endl;
+      }
+    });
+    error = compare_kernels(q, matSize);
+    std::cout << (error ? " Error in the computation " : "Success")
+              << std::endl;
+  }
+
+  if (testGemm) {
+    queue q([&](exception_list eL) {
+      try {
+        for (auto& e : eL) {
+          std::rethrow_exception(e);
+        }
+      } catch (cl::sycl::exception e) {
+        std::cout << " An exception has been thrown: " << e.what()
+                  << std::endl;
+      }
+    });
+    error = test_gemm(q, matSize) || test_gemm_batched(q);
+    std::cout << (error ? " Error in the computation " : "Success")
+              << std::endl;
+  }
+
   delete[] MA;
   delete[] MB;
   delete[] MC;
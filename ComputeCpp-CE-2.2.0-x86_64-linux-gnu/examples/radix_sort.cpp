@@ -0,0 +1,154 @@
+/***************************************************************************
+ *
+ *  Copyright (C) 2017 Codeplay Software Limited
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  For your convenience, a copy of the License has been included in this
+ *  repository.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  Codeplay's ComputeCpp SDK
+ *
+ *  radix_sort.cpp
+ *
+ *  Description:
+ *    Tests the radix sort of radix_sort.hpp against std::stable_sort.
+ *
+ **************************************************************************/
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "radix_sort.hpp"
+
+/* Sorts `keys` on q, in place, without values. */
+template <typename Key>
+void device_sort(sycl::queue& q, std::vector<Key>& keys, sort_order order) {
+  sycl::buffer<Key, 1> buf(keys.data(), sycl::range<1>(keys.size()));
+  par_radix_sort<Key>(buf, q, order);
+}
+
+/* Tests a key-only sort of `size` keys drawn from `dist` in the given order.
+ * Returns 0 if successful, a nonzero value otherwise. */
+template <typename Key, typename Dist>
+int test_keys(sycl::queue& q, const char* name, size_t size, Dist dist,
+              sort_order order) {
+  std::mt19937_64 gen(size);
+  std::vector<Key> keys(size);
+  for (auto& key : keys) {
+    key = static_cast<Key>(dist(gen));
+  }
+
+  std::vector<Key> expected = keys;
+  if (order == sort_order::ascending) {
+    std::sort(expected.begin(), expected.end());
+  } else {
+    std::sort(expected.begin(), expected.end(), std::greater<Key>());
+  }
+
+  device_sort(q, keys, order);
+
+  if (keys != expected) {
+    std::cout << "SYCL " << name << " sort of " << size
+              << " keys incorrect!\n";
+    return 1;
+  }
+  return 0;
+}
+
+/* Tests a sort of `size` keys with their original positions as values. Keys
+ * come from a small range, so that there are many equal ones and the order of
+ * their values checks that the sort is stable. Returns 0 if successful, a
+ * nonzero value otherwise. */
+int test_pairs(sycl::queue& q, size_t size, sort_order order) {
+  std::mt19937 gen(size);
+  std::uniform_int_distribution<int32_t> dist(-50, 50);
+  std::vector<int32_t> keys(size);
+  std::vector<uint32_t> values(size);
+  for (size_t i = 0; i < size; i++) {
+    keys[i] = dist(gen);
+    values[i] = static_cast<uint32_t>(i);
+  }
+
+  std::vector<std::pair<int32_t, uint32_t>> expected(size);
+  for (size_t i = 0; i < size; i++) {
+    expected[i] = {keys[i], values[i]};
+  }
+  std::stable_sort(expected.begin(), expected.end(),
+                   [order](const std::pair<int32_t, uint32_t>& a,
+                           const std::pair<int32_t, uint32_t>& b) {
+                     return (order == sort_order::ascending)
+                                ? a.first < b.first
+                                : a.first > b.first;
+                   });
+
+  {
+    sycl::buffer<int32_t, 1> key_buf(keys.data(), sycl::range<1>(size));
+    sycl::buffer<uint32_t, 1> value_buf(values.data(), sycl::range<1>(size));
+    par_radix_sort<int32_t, uint32_t>(key_buf, value_buf, q, order);
+  }
+
+  for (size_t i = 0; i < size; i++) {
+    if (keys[i] != expected[i].first || values[i] != expected[i].second) {
+      std::cout << "SYCL sort of " << size << " pairs incorrect at " << i
+                << ": (" << keys[i] << ", " << values[i] << ") instead of ("
+                << expected[i].first << ", " << expected[i].second << ")\n";
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main() {
+  sycl::queue q;
+
+  const size_t sizes[] = {1, 7, 1000, 20011};
+  std::uniform_int_distribution<uint32_t> any32;
+  std::uniform_int_distribution<int64_t> any64(
+      std::numeric_limits<int64_t>::lowest(),
+      std::numeric_limits<int64_t>::max());
+  std::uniform_real_distribution<float> floats(-1e6f, 1e6f);
+  std::uniform_real_distribution<double> doubles(-1.0, 1.0);
+
+  for (size_t size : sizes) {
+    int ret = test_keys<uint32_t>(q, "uint32_t", size, any32,
+                                  sort_order::ascending);
+    if (ret == 0) {
+      ret = test_keys<int64_t>(q, "descending int64_t", size, any64,
+                               sort_order::descending);
+    }
+    if (ret == 0) {
+      ret = test_keys<float>(q, "float", size, floats, sort_order::ascending);
+    }
+    if (ret == 0) {
+      ret = test_keys<double>(q, "descending double", size, doubles,
+                              sort_order::descending);
+    }
+    if (ret == 0) {
+      ret = test_pairs(q, size, sort_order::ascending);
+    }
+    if (ret == 0) {
+      ret = test_pairs(q, size, sort_order::descending);
+    }
+    if (ret != 0) {
+      return ret;
+    }
+  }
+
+  std::cout << "Results are correct." << std::endl;
+  return 0;
+}
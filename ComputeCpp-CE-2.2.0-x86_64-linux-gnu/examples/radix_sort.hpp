@@ -0,0 +1,376 @@
+/***************************************************************************
+ *
+ *  Copyright (C) 2017 Codeplay Software Limited
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  For your convenience, a copy of the License has been included in this
+ *  repository.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  Codeplay's ComputeCpp SDK
+ *
+ *  radix_sort.hpp
+ *
+ *  Description:
+ *    Stable least-significant-digit radix sort in SYCL for 32-bit and 64-bit
+ *    keys, with optional values, built on the scans of scan.hpp.
+ *
+ **************************************************************************/
+
+#ifndef RADIX_SORT_HPP
+#define RADIX_SORT_HPP
+
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#include "scan.hpp"
+
+// Number of key bits every pass of the radix sort orders by.
+constexpr unsigned radix_bits = 4;
+constexpr size_t radix_digits = size_t(1) << radix_bits;
+
+// Order of the keys after a sort.
+enum class sort_order { ascending, descending };
+
+/* Maps a key to an unsigned integer of the same width whose unsigned order is
+ * the order of the keys. Unsigned keys map to themselves and signed ones have
+ * their sign bit flipped. */
+template <typename T>
+struct radix_key {};
+
+template <>
+struct radix_key<uint32_t> {
+  using bits = uint32_t;
+  static bits to_bits(uint32_t key) { return key; }
+};
+
+template <>
+struct radix_key<uint64_t> {
+  using bits = uint64_t;
+  static bits to_bits(uint64_t key) { return key; }
+};
+
+template <>
+struct radix_key<int32_t> {
+  using bits = uint32_t;
+  static bits to_bits(int32_t key) {
+    return static_cast<bits>(key) ^ (bits(1) << 31);
+  }
+};
+
+template <>
+struct radix_key<int64_t> {
+  using bits = uint64_t;
+  static bits to_bits(int64_t key) {
+    return static_cast<bits>(key) ^ (bits(1) << 63);
+  }
+};
+
+/* Floating-point keys: negative values have all their bits flipped, which
+ * reverses their order, and the others only their sign bit, which moves them
+ * above the negative ones. -0.0 sorts before 0.0 and NaNs with the sign bit
+ * clear after infinity. */
+template <>
+struct radix_key<float> {
+  using bits = uint32_t;
+  static bits to_bits(float key) {
+    bits b = sycl::vec<float, 1>(key).as<sycl::vec<bits, 1>>().s0();
+    bits sign = bits(1) << 31;
+    return (b & sign) ? ~b : (b | sign);
+  }
+};
+
+template <>
+struct radix_key<double> {
+  using bits = uint64_t;
+  static bits to_bits(double key) {
+    bits b = sycl::vec<double, 1>(key).as<sycl::vec<bits, 1>>().s0();
+    bits sign = bits(1) << 63;
+    return (b & sign) ? ~b : (b | sign);
+  }
+};
+
+/* Value type of a sort that only moves keys. Its buffers hold one element and
+ * are never accessed by the kernels. */
+struct radix_no_values {};
+
+// Names the radix sort kernels for each number of keys per work-item.
+template <size_t K>
+class radix_histogram;
+template <size_t K>
+class radix_scatter;
+
+/* Returns the digit of `key` that starts at bit `shift`, after XOR-ing the
+ * ordered bits with `flip`, which reverses the order if all its bits are
+ * set. */
+template <typename Key>
+size_t radix_digit(Key key, unsigned shift,
+                   typename radix_key<Key>::bits flip) {
+  return static_cast<size_t>(((radix_key<Key>::to_bits(key) ^ flip) >> shift) &
+                             (radix_digits - 1));
+}
+
+/* Work-group size of a sort of `n` keys, `K` per work-item: the one of the
+ * scan, halved until a count per digit for every work-item fits in local
+ * memory next to the scan tree. */
+template <size_t K>
+size_t radix_sort_wgroup_size(const sycl::device& dev, size_t n) {
+  size_t wgroup_size = scan_wgroup_size<uint32_t>(dev, n, K);
+  size_t local_mem_size = dev.get_info<sycl::info::device::local_mem_size>();
+  while (wgroup_size > 1 && wgroup_size * (radix_digits + 1) *
+                                    sizeof(uint32_t) >
+                                local_mem_size) {
+    wgroup_size /= 2;
+  }
+  return wgroup_size;
+}
+
+/* Loads the `K` consecutive keys of this work-item from the first `n` of
+ * `src` and computes the position of each in the output of a pass over the
+ * digit at `shift`: the start of its digit in the whole input, from the
+ * scanned tile histograms `tile_offsets` (digit-major over `n_tiles` tiles),
+ * plus its rank among the keys of the tile with the same digit. Keys keep
+ * their order within a digit, so the pass is stable. `counts` holds a count
+ * per digit and work-item and `temp` one value per work-item. Every
+ * work-item of the group has to call this. */
+template <typename Key, size_t K, typename Keys, typename Offsets>
+void radix_rank(sycl::nd_item<1> item, Keys src, size_t n, unsigned shift,
+                typename radix_key<Key>::bits flip, Offsets tile_offsets,
+                size_t n_tiles,
+                sycl::accessor<uint32_t, 1, sycl::access::mode::read_write,
+                               sycl::access::target::local>
+                    counts,
+                sycl::accessor<uint32_t, 1, sycl::access::mode::read_write,
+                               sycl::access::target::local>
+                    temp,
+                Key (&keys)[K], size_t (&pos)[K]) {
+  size_t lid = item.get_local_linear_id();
+  size_t wgroup_size = item.get_local_range(0);
+  size_t tile = item.get_group_linear_id();
+  size_t first = item.get_global_linear_id() * K;
+
+  // Count this work-item's digits in registers.
+  uint32_t mine[radix_digits];
+  for (size_t d = 0; d < radix_digits; d++) {
+    mine[d] = 0;
+  }
+  size_t digits[K];
+  for (size_t k = 0; k < K; k++) {
+    if (first + k < n) {
+      keys[k] = src[first + k];
+      digits[k] = radix_digit(keys[k], shift, flip);
+      mine[digits[k]]++;
+    }
+  }
+  for (size_t d = 0; d < radix_digits; d++) {
+    counts[d * wgroup_size + lid] = mine[d];
+  }
+  item.barrier(sycl::access::fence_space::local_space);
+
+  /* Exclusive scan of the counts in digit-major order, after which
+   * counts[d * wgroup_size + lid] is the position of this work-item's first
+   * key with digit d in the tile sorted by digit. Every work-item scans
+   * `radix_digits` consecutive counts and only their totals go through the
+   * scan tree. */
+  uint32_t sum = 0;
+  for (size_t d = 0; d < radix_digits; d++) {
+    uint32_t count = counts[lid * radix_digits + d];
+    counts[lid * radix_digits + d] = sum;
+    sum += count;
+  }
+  temp[lid] = sum;
+  scan_local<uint32_t, std::plus<uint32_t>>(item, temp, wgroup_size, 0);
+  uint32_t before = temp[lid];
+  for (size_t d = 0; d < radix_digits; d++) {
+    counts[lid * radix_digits + d] += before;
+  }
+  item.barrier(sycl::access::fence_space::local_space);
+
+  // Rank of this work-item's first key of each digit among the tile's keys.
+  for (size_t d = 0; d < radix_digits; d++) {
+    uint32_t start = counts[d * wgroup_size];
+    uint32_t at = counts[d * wgroup_size + lid];
+    mine[d] = at - start;
+  }
+  for (size_t k = 0; k < K; k++) {
+    if (first + k < n) {
+      size_t d = digits[k];
+      size_t offset = tile_offsets[d * n_tiles + tile];
+      pos[k] = offset + mine[d];
+      mine[d]++;
+    }
+  }
+}
+
+/* Sorts `keys` and moves `values` along with them, if `Value` is not
+ * `radix_no_values`; see `par_radix_sort`. */
+template <typename Key, typename Value, size_t K>
+void radix_sort(sycl::buffer<Key, 1>& keys, sycl::buffer<Value, 1>& values,
+                sycl::queue& q, sort_order order) {
+  static_assert(K > 0, "Each work-item needs at least one key.");
+  using bits = typename radix_key<Key>::bits;
+  constexpr bool has_values = !std::is_same<Value, radix_no_values>::value;
+  constexpr unsigned passes = sizeof(bits) * 8 / radix_bits;
+  static_assert(passes % 2 == 0,
+                "An odd number of passes leaves the keys in the temporary "
+                "buffer.");
+
+  size_t n = keys.get_count();
+  if (has_values && values.get_count() != n) {
+    throw std::runtime_error("Sort keys and values sizes differ.");
+  }
+  if (n < 2) {
+    return;
+  }
+
+  size_t wgroup_size = radix_sort_wgroup_size<K>(q.get_device(), n);
+  size_t items = (n + K - 1) / K;
+  size_t n_tiles = (items + wgroup_size - 1) / wgroup_size;
+  size_t n_counts = radix_digits * n_tiles;
+  bits flip = (order == sort_order::descending) ? ~bits(0) : bits(0);
+
+  // Passes alternate between the input and these buffers.
+  sycl::buffer<Key, 1> keys_tmp(sycl::range<1>{n});
+  sycl::buffer<Value, 1> values_tmp(sycl::range<1>{has_values ? n : 1});
+  sycl::buffer<size_t, 1> counts(sycl::range<1>{n_counts});
+  sycl::buffer<size_t, 1> offsets(sycl::range<1>{n_counts});
+  scan_workspace<size_t> workspace(q, n_counts);
+
+  sycl::buffer<Key, 1>* keys_in = &keys;
+  sycl::buffer<Key, 1>* keys_out = &keys_tmp;
+  sycl::buffer<Value, 1>* values_in = &values;
+  sycl::buffer<Value, 1>* values_out = &values_tmp;
+
+  for (unsigned pass = 0; pass < passes; pass++) {
+    unsigned shift = pass * radix_bits;
+
+    /* Histogram of the digits of every tile, counted with atomics in local
+     * memory from per-work-item counts, stored digit-major so that their
+     * exclusive scan gives every tile the output offset of each digit. */
+    q.submit([&](sycl::handler& cgh) {
+      auto src = keys_in->template get_access<sycl::access::mode::read>(cgh);
+      auto dst =
+          counts.template get_access<sycl::access::mode::discard_write>(cgh);
+      sycl::accessor<uint32_t, 1, sycl::access::mode::atomic,
+                     sycl::access::target::local>
+          histogram(sycl::range<1>(radix_digits), cgh);
+
+      cgh.parallel_for<kernel_name<Key, Value, radix_histogram<K>>>(
+          sycl::nd_range<1>(n_tiles * wgroup_size, wgroup_size),
+          [=](sycl::nd_item<1> item) {
+            size_t lid = item.get_local_linear_id();
+            size_t tile = item.get_group_linear_id();
+            size_t first = item.get_global_linear_id() * K;
+
+            for (size_t d = lid; d < radix_digits; d += wgroup_size) {
+              histogram[d].store(0);
+            }
+            item.barrier(sycl::access::fence_space::local_space);
+
+            uint32_t mine[radix_digits];
+            for (size_t d = 0; d < radix_digits; d++) {
+              mine[d] = 0;
+            }
+            for (size_t k = 0; k < K; k++) {
+              if (first + k < n) {
+                mine[radix_digit(src[first + k], shift, flip)]++;
+              }
+            }
+            for (size_t d = 0; d < radix_digits; d++) {
+              if (mine[d] != 0) {
+                histogram[d].fetch_add(mine[d]);
+              }
+            }
+            item.barrier(sycl::access::fence_space::local_space);
+
+            for (size_t d = lid; d < radix_digits; d += wgroup_size) {
+              dst[d * n_tiles + tile] = histogram[d].load();
+            }
+          });
+    });
+
+    par_scan<size_t, std::plus<size_t>>(counts, offsets, q, 0,
+                                        scan_type::exclusive,
+                                        scan_algorithm::automatic, &workspace);
+
+    // Move every key, and its value, to its position for this digit.
+    q.submit([&](sycl::handler& cgh) {
+      auto src = keys_in->template get_access<sycl::access::mode::read>(cgh);
+      auto dst =
+          keys_out->template get_access<sycl::access::mode::discard_write>(
+              cgh);
+      auto src_values =
+          values_in->template get_access<sycl::access::mode::read>(cgh);
+      auto dst_values =
+          values_out->template get_access<sycl::access::mode::discard_write>(
+              cgh);
+      auto tile_offsets =
+          offsets.template get_access<sycl::access::mode::read>(cgh);
+      sycl::accessor<uint32_t, 1, sycl::access::mode::read_write,
+                     sycl::access::target::local>
+          local_counts(sycl::range<1>(radix_digits * wgroup_size), cgh);
+      sycl::accessor<uint32_t, 1, sycl::access::mode::read_write,
+                     sycl::access::target::local>
+          temp(sycl::range<1>(wgroup_size), cgh);
+
+      cgh.parallel_for<kernel_name<Key, Value, radix_scatter<K>>>(
+          sycl::nd_range<1>(n_tiles * wgroup_size, wgroup_size),
+          [=](sycl::nd_item<1> item) {
+            Key keys[K];
+            size_t pos[K];
+            radix_rank<Key, K>(item, src, n, shift, flip, tile_offsets,
+                               n_tiles, local_counts, temp, keys, pos);
+
+            size_t first = item.get_global_linear_id() * K;
+            for (size_t k = 0; k < K; k++) {
+              if (first + k < n) {
+                dst[pos[k]] = keys[k];
+                if constexpr (!std::is_same<Value, radix_no_values>::value) {
+                  dst_values[pos[k]] = src_values[first + k];
+                }
+              }
+            }
+          });
+    });
+
+    std::swap(keys_in, keys_out);
+    std::swap(values_in, values_out);
+  }
+}
+
+/* Sorts `keys` in the given order and applies the same permutation to
+ * `values`, which must have the same size. Runs in parallel on the provided
+ * queue. Keys are 32-bit or 64-bit integers or floating-point values, see
+ * `radix_key`, and the sort is stable, so equal keys keep the order of their
+ * values. Every pass orders by `radix_bits` bits: each tile of `K` keys per
+ * work-item counts its digits in a local-memory histogram, an exclusive
+ * `par_scan` of all tile histograms gives the output offset of every digit in
+ * every tile, and a second kernel ranks the keys within their tile and
+ * scatters them. The passes alternate between the input and a temporary
+ * buffer of the same size, and the result ends up in the input. */
+template <typename Key, typename Value,
+          size_t K = scan_items_per_work_item<Key>::value>
+void par_radix_sort(sycl::buffer<Key, 1>& keys, sycl::buffer<Value, 1>& values,
+                    sycl::queue& q, sort_order order = sort_order::ascending) {
+  radix_sort<Key, Value, K>(keys, values, q, order);
+}
+
+// Sorts `keys` in the given order without values.
+template <typename Key, size_t K = scan_items_per_work_item<Key>::value>
+void par_radix_sort(sycl::buffer<Key, 1>& keys, sycl::queue& q,
+                    sort_order order = sort_order::ascending) {
+  sycl::buffer<radix_no_values, 1> none(sycl::range<1>{1});
+  radix_sort<Key, radix_no_values, K>(keys, none, q, order);
+}
+
+#endif  // RADIX_SORT_HPP
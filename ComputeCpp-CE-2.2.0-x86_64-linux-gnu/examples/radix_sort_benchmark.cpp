@@ -0,0 +1,147 @@
+/***************************************************************************
+ *
+ *  Copyright (C) 2017 Codeplay Software Limited
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  For your convenience, a copy of the License has been included in this
+ *  repository.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  Codeplay's ComputeCpp SDK
+ *
+ *  radix_sort_benchmark.cpp
+ *
+ *  Description:
+ *    Compares the radix sort of radix_sort.hpp on the host and CPU devices
+ *    with std::sort and a parallel host sort.
+ *
+ **************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "radix_sort.hpp"
+
+/* Sorts `keys` on the host with one std::sort per hardware thread on
+ * contiguous ranges, then merges neighbouring ranges in parallel rounds. */
+void host_parallel_sort(std::vector<uint32_t>& keys) {
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t chunk = (keys.size() + threads - 1) / threads;
+  if (threads == 1 || chunk == 0) {
+    std::sort(keys.begin(), keys.end());
+    return;
+  }
+
+  auto at = [&](size_t i) {
+    return keys.begin() + std::min(i, keys.size());
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; t++) {
+    workers.emplace_back(
+        [&, t] { std::sort(at(t * chunk), at((t + 1) * chunk)); });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+
+  for (size_t width = chunk; width < keys.size(); width *= 2) {
+    workers.clear();
+    for (size_t begin = 0; begin + width < keys.size(); begin += 2 * width) {
+      workers.emplace_back([&, begin, width] {
+        std::inplace_merge(at(begin), at(begin + width),
+                           at(begin + 2 * width));
+      });
+    }
+    for (auto& w : workers) {
+      w.join();
+    }
+  }
+}
+
+/* Runs `iterations` sorts of copies of `in` with `sort` and returns the
+ * average time per sort in milliseconds, or a negative value if a result is
+ * wrong. The first run is not timed. */
+template <typename Sort>
+double time_sort(const std::vector<uint32_t>& in,
+                 const std::vector<uint32_t>& expected, int iterations,
+                 Sort sort) {
+  double total = 0.0;
+  for (int i = -1; i < iterations; i++) {
+    std::vector<uint32_t> keys = in;
+
+    auto start = std::chrono::steady_clock::now();
+    sort(keys);
+    auto end = std::chrono::steady_clock::now();
+
+    if (i >= 0) {
+      total += std::chrono::duration<double, std::milli>(end - start).count();
+    }
+    if (keys != expected) {
+      return -1.0;
+    }
+  }
+  return total / iterations;
+}
+
+/* Times the radix sort on q, including the copies to and from the device. */
+void time_radix_sort(sycl::queue& q, const std::vector<uint32_t>& in,
+                     const std::vector<uint32_t>& expected, int iterations) {
+  double radix =
+      time_sort(in, expected, iterations, [&](std::vector<uint32_t>& keys) {
+        sycl::buffer<uint32_t, 1> buf(keys.data(),
+                                      sycl::range<1>(keys.size()));
+        par_radix_sort<uint32_t>(buf, q);
+      });
+  std::cout << "  radix sort: " << radix << " ms\n";
+}
+
+/* usage: ./radix_sort_benchmark [elements] [iterations] */
+int main(int argc, char* argv[]) {
+  size_t size = (argc > 1) ? std::stoul(argv[1]) : 65536u;
+  int iterations = (argc > 2) ? std::stoi(argv[2]) : 5;
+
+  std::mt19937 gen(size);
+  std::vector<uint32_t> in(size);
+  for (auto& key : in) {
+    key = gen();
+  }
+
+  std::vector<uint32_t> expected = in;
+  std::sort(expected.begin(), expected.end());
+
+  std::cout << "Elements: " << size << ", iterations: " << iterations << '\n';
+
+  double serial =
+      time_sort(in, expected, iterations, [](std::vector<uint32_t>& keys) {
+        std::sort(keys.begin(), keys.end());
+      });
+  std::cout << "std::sort: " << serial << " ms\n";
+
+  double parallel = time_sort(in, expected, iterations, host_parallel_sort);
+  std::cout << "Parallel host sort (" << std::thread::hardware_concurrency()
+            << " threads): " << parallel << " ms\n";
+
+  auto radix = [&](sycl::queue& q) {
+    time_radix_sort(q, in, expected, iterations);
+  };
+  time_on("Host", sycl::host_selector{}, radix);
+  time_on("CPU", sycl::cpu_selector{}, radix);
+
+  return 0;
+}
@@ -26,30 +26,754 @@
  **************************************************************************/
 
 #include <CL/sycl.hpp>
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <vector>
+#include "extrema.hpp"
 
 
 
 namespace chiu{
 
-    template<typename T>
+    /* Transform of a plain reduction, which passes every element through. */
+    struct no_transform{
+        template <typename X>
+        X operator()(const X& x) const{ return x; }
+    };
+
+
+    /* Dummy class to generate unique kernel names. The binary operator is part
+     * of the name, so it has to be a named function object (e.g. std::plus<T>)
+     * rather than a lambda. N is the number of elements loaded at once, Mem
+     * the kind of memory the kernel reads and X the transform applied to the
+     * elements of type T before they are reduced. */
+    template<typename T, typename C, int N, typename Mem, typename X = no_transform>
     class sycl_reduction;
 
 
+    /* Transforms in kernel names: U maps each element to R, and B maps each
+     * pair of elements, the second of type T2, to R. Like the binary operator,
+     * U and B have to be named function object types. */
+    template <typename R, typename U>
+    struct unary_transform;
+
+    template <typename T2, typename R, typename B>
+    struct binary_transform;
+
+
+    /* Kernel names of segmented_reduce: the pass over the segments and the
+     * pass combining the pieces of segments that were split. */
+    template<typename T, typename C>
+    class sycl_segmented_reduction;
+
+    template<typename T, typename C>
+    class sycl_segmented_combine;
+
+
+    /* Kernel name of the passes of deterministic_reduce. Lift is set for the
+     * first pass, which reads elements of T rather than accumulators. */
+    template<typename T, typename F, bool Lift>
+    class sycl_deterministic_reduction;
+
+
+    /* Tags for the memory a reduction kernel works on: SYCL buffers through
+     * accessors, or USM device allocations through pointers. */
+    struct buffer_memory;
+    struct usm_memory;
+
+
+    /* Number of elements a work-item loads at once as a cl::sycl::vec<T, N>.
+     * The types vec supports are read 16 bytes at a time; any other element
+     * type is read one element at a time. */
+    template <typename T>
+    struct reduction_vector_width{
+        static constexpr int value = 1;
+    };
+
+    template <> struct reduction_vector_width<char>{ static constexpr int value = 16; };
+    template <> struct reduction_vector_width<signed char>{ static constexpr int value = 16; };
+    template <> struct reduction_vector_width<unsigned char>{ static constexpr int value = 16; };
+    template <> struct reduction_vector_width<short>{ static constexpr int value = 8; };
+    template <> struct reduction_vector_width<unsigned short>{ static constexpr int value = 8; };
+    template <> struct reduction_vector_width<cl::sycl::half>{ static constexpr int value = 8; };
+    template <> struct reduction_vector_width<int>{ static constexpr int value = 4; };
+    template <> struct reduction_vector_width<unsigned int>{ static constexpr int value = 4; };
+    template <> struct reduction_vector_width<float>{ static constexpr int value = 4; };
+    template <> struct reduction_vector_width<long>{ static constexpr int value = 2; };
+    template <> struct reduction_vector_width<unsigned long>{ static constexpr int value = 2; };
+    template <> struct reduction_vector_width<double>{ static constexpr int value = 2; };
+
+
+    /* Number of work-groups launched per compute unit in the first pass. A few
+     * groups per unit keep every unit busy while the partial results still fit
+     * into a single work-group for the second pass. */
+    constexpr size_t groups_per_compute_unit = 4;
+
+
+    /* segmented_reduce gives each segment of up to segmented_small_segment
+     * elements to a single work-item. Longer segments are cut into chunks of
+     * segmented_items_per_work_item elements per work-item of a work-group. */
+    constexpr size_t segmented_small_segment = 32;
+    constexpr size_t segmented_items_per_work_item = 16;
+
+
+    /* Number of values each work-item of deterministic_reduce folds, in order,
+     * on every pass. The shape of the reduction tree only depends on it and on
+     * the input length. */
+    constexpr size_t deterministic_block = 256;
+
+
+    /* Returns the smallest power of two that is greater than or equal to x. */
+    inline size_t next_pow2(size_t x){
+        size_t p = 1;
+        while(p < x)    p <<= 1;
+        return p;
+    }
+
+
+    /* Returns the largest power of two that is less than or equal to x (x > 0). */
+    inline size_t prev_pow2(size_t x){
+        size_t p = 1;
+        while(p <= x / 2)    p <<= 1;
+        return p;
+    }
+
+
+    /* Returns the work-group size used for reductions of T on device. It is
+     * bounded by the device limit and by the local memory needed for one
+     * element per work-item. */
+    template <typename T>
+    size_t reduction_local_size(const cl::sycl::device& device){
+        size_t maxLocal = std::min(device.get_info<cl::sycl::info::device::max_work_group_size>(),
+                                   device.get_info<cl::sycl::info::device::local_mem_size>() / sizeof(T));
+        return prev_pow2(maxLocal);
+    }
+
+
+    /* True for the wrapped USM pointers that kernels read instead of accessors. */
+    template <typename A>
+    struct is_usm_wrapper : std::false_type{};
+
+    template <typename T>
+    struct is_usm_wrapper<cl::sycl::experimental::usm_wrapper<T>> : std::true_type{};
+
+
+    /* Loads the i-th group of N consecutive elements of the accessor aI into
+     * lanes with a single vector load. */
+    template <int N, typename T, typename A>
+    inline void sycl_reduce_lanes(const A& aI, size_t i, T (&lanes)[N]){
+        cl::sycl::vec<T, N> x;
+        x.load(i, aI);
+        x.store(0, cl::sycl::private_ptr<T>(lanes));
+    }
+
+
+    /* Element source of a reduction kernel over one input of T. Element i is
+     * tf(aI[i]); load<N>(i, bop) folds the i-th group of N consecutive
+     * elements. Accessors are read with a single vector load for N > 1; USM
+     * pointers are read one element at a time. */
+    template <typename T, typename R, typename A, typename U>
+    struct unary_source{
+        A aI;
+        U tf;
+
+        R operator[](size_t i) const{ return tf(aI[i]); }
+
+        template <int N, typename C>
+        R load(size_t i, C bop) const{
+            if constexpr(N == 1 || is_usm_wrapper<A>::value){
+                R acc = (*this)[i * N];
+                for(int j = 1; j < N; j++)    acc = bop(acc, (*this)[i * N + j]);
+                return acc;
+            }
+            else{
+                T lanes[N];
+                sycl_reduce_lanes<N>(aI, i, lanes);
+
+                R acc = tf(lanes[0]);
+                for(int j = 1; j < N; j++)    acc = bop(acc, tf(lanes[j]));
+                return acc;
+            }
+        }
+    };
+
+
+    /* Element source of a reduction kernel over two inputs of T1 and T2.
+     * Element i is tf(a1[i], a2[i]); see unary_source. */
+    template <typename T1, typename T2, typename R, typename A1, typename A2, typename B>
+    struct binary_source{
+        A1 a1;
+        A2 a2;
+        B tf;
+
+        R operator[](size_t i) const{ return tf(a1[i], a2[i]); }
+
+        template <int N, typename C>
+        R load(size_t i, C bop) const{
+            if constexpr(N == 1 || is_usm_wrapper<A1>::value || is_usm_wrapper<A2>::value){
+                R acc = (*this)[i * N];
+                for(int j = 1; j < N; j++)    acc = bop(acc, (*this)[i * N + j]);
+                return acc;
+            }
+            else{
+                T1 lanes1[N];
+                T2 lanes2[N];
+                sycl_reduce_lanes<N>(a1, i, lanes1);
+                sycl_reduce_lanes<N>(a2, i, lanes2);
+
+                R acc = tf(lanes1[0], lanes2[0]);
+                for(int j = 1; j < N; j++)    acc = bop(acc, tf(lanes1[j], lanes2[j]));
+                return acc;
+            }
+        }
+    };
+
+
+    /* Build the element source of a pass from the inputs bound to its command
+     * group, so that the same pass code serves accessors and USM pointers. */
+    template <typename T, typename R, typename U>
+    struct unary_sources{
+        U tf;
+
+        template <typename A>
+        unary_source<T, R, A, U> operator()(A a) const{ return { a, tf }; }
+    };
+
+    template <typename T1, typename T2, typename R, typename B>
+    struct binary_sources{
+        B tf;
+
+        template <typename A1, typename A2>
+        binary_source<T1, T2, R, A1, A2, B> operator()(A1 a1, A2 a2) const{ return { a1, a2, tf }; }
+    };
+
+
+    /* Binds the memory of a reduction pass to its command group. Buffers are
+     * accessed through accessors; only the first count elements of an output
+     * buffer are written, so the rest of it is left untouched. USM pointers are
+     * wrapped, since kernels cannot capture raw pointers. */
+    template <typename T>
+    auto reduction_input(cl::sycl::handler& h, cl::sycl::buffer<T, 1>& buf){
+        return buf.template get_access<cl::sycl::access::mode::read>(h);
+    }
+
+    template <typename T>
+    cl::sycl::experimental::usm_wrapper<T> reduction_input(cl::sycl::handler&, const T* ptr){
+        return const_cast<T*>(ptr);
+    }
+
+    template <typename T>
+    auto reduction_output(cl::sycl::handler& h, cl::sycl::buffer<T, 1>& buf, size_t count){
+        return buf.template get_access<cl::sycl::access::mode::discard_write>(h, cl::sycl::range<1>(count));
+    }
+
+    template <typename T>
+    cl::sycl::experimental::usm_wrapper<T> reduction_output(cl::sycl::handler&, T* ptr, size_t){ return ptr; }
+
+
+    /* Kind of memory behind a buffer or a USM pointer, for kernel names. */
+    template <typename M>
+    struct reduction_memory{ using type = buffer_memory; };
+
+    template <typename T>
+    struct reduction_memory<T*>{ using type = usm_memory; };
+
+
+
+    /* Returns the kernel of one grid-stride reduction pass. The work-items read
+     * `length` elements of src, N at a time, and every work-group writes one
+     * partial result into aO, which is an accessor or a USM pointer. The
+     * launch must satisfy groups * local * N <= length, so every work-item owns
+     * at least one element and no identity value is needed for bop. If
+     * foldInit is set, the partial results are folded into init, which is only
+     * meaningful for a launch with a single work-group. */
+    template <int N, typename R, typename Src, typename Out, typename S, typename C>
+    auto sycl_reduce_kernel(Src src, Out aO, S scratch, size_t length, size_t local, C bop, bool foldInit, R init){
+        /* The tree below halves the active range on every step, so it starts
+         * from the power of two just below the work-group size. */
+        size_t half = next_pow2(local) / 2;
+
+        return [src, aO, scratch, length, local, half, bop, foldInit, init](cl::sycl::nd_item<1> id){
+            size_t globalid = id.get_global_id(0);
+            size_t localid = id.get_local_id(0);
+            size_t stride = id.get_global_range(0);
+
+            /* Each work-item first folds every stride-th group of N
+             * elements into a private accumulator, so any input length is
+             * covered by a launch sized to the device rather than to the
+             * data. The elements after the last full group are strided over
+             * the same way, one at a time. */
+            size_t vecLength = length / N;
+
+            R acc = src.template load<N>(globalid, bop);
+            for(size_t i = globalid + stride; i < vecLength; i += stride)    acc = bop(acc, src.template load<N>(i, bop));
+            if(N > 1){
+                for(size_t i = vecLength * N + globalid; i < length; i += stride)    acc = bop(acc, src[i]);
+            }
+
+            /* All work-items write their accumulators into local memory.
+             * The barrier ensures all writes are visible to the work-group
+             * before the tree reduction starts. */
+            scratch[localid] = acc;
+            id.barrier(cl::sycl::access::fence_space::local_space);
+
+            /* Apply the reduction operation between the current local id and
+             * the one on the other half of the range. The bound check keeps
+             * non power-of-two work-group sizes correct. */
+            for(size_t offset = half; offset > 0; offset /= 2){
+                if(localid < offset && localid + offset < local)    scratch[localid] = bop(scratch[localid], scratch[localid + offset]);
+                id.barrier(cl::sycl::access::fence_space::local_space);
+            }
+
+            /* The result of the work-group is stored in local id 0. */
+            if(localid == 0){
+                R result = scratch[0];
+                aO[id.get_group(0)] = foldInit ? bop(init, result) : result;
+            }
+        };
+    }
+
+
+    /* Enqueues one reduction pass named Name; see sycl_reduce_kernel. The
+     * inputs and out are all buffers or all USM pointers, and make builds the
+     * element source from the bound inputs. USM accesses are not tracked by
+     * the runtime, so the pass waits for deps. If prebuilt is given, the
+     * kernel is launched from it instead of being looked up on submission. */
+    template <typename Name, int N, typename R, typename Out, typename C, typename Make, typename... In>
+    cl::sycl::event sycl_reduce_pass(cl::sycl::queue& q, Out& out, size_t length, size_t groups, size_t local,
+                                     C bop, bool foldInit, const R& init, const cl::sycl::kernel* prebuilt,
+                                     const std::vector<cl::sycl::event>& deps, Make make, In&... in){
+        return q.submit([&](cl::sycl::handler& h){
+            cl::sycl::nd_range<1> r{ cl::sycl::range<1>{ groups * local }, cl::sycl::range<1>{ local } };
+
+            /* The inputs and the partial results are bound to the command
+             * group, and a local accessor stores intermediate data. */
+            auto src = make(reduction_input(h, in)...);
+            auto aO = reduction_output(h, out, groups);
+            cl::sycl::accessor<R, 1, cl::sycl::access::mode::read_write,
+                                     cl::sycl::access::target::local> scratch(cl::sycl::range<1>(local), h);
+
+            if(!deps.empty())    h.depends_on(deps);
+
+            auto kernel = sycl_reduce_kernel<N>(src, aO, scratch, length, local, bop, foldInit, init);
+
+            /* The parallel_for invocation chosen is the variant with an nd_item
+             * parameter, since the code requires barriers for correctness. */
+            if(prebuilt)    h.parallel_for<Name>(*prebuilt, r, kernel);
+            else            h.parallel_for<Name>(r, kernel);
+        });
+    }
+
+
+    /* Enqueues the complete reduction of the first `length` elements built by
+     * make from the inputs, folds the result into init and writes it to the
+     * first element of out. The inputs, partials and out are all buffers or
+     * all USM pointers; partials needs room for maxLocal values. The first
+     * pass is named sycl_reduction<T, C, N, Mem, X> for the vector loads and
+     * with N = 1 for the scalar ones; it uses vector loads whenever the input
+     * holds at least one full vector. The second pass over the partial results
+     * always reads scalars. Returns the event of the last pass. */
+    template <typename T, typename X, int N, typename R, typename C, typename P, typename Out, typename Make, typename... In>
+    cl::sycl::event transform_reduce_enqueue(cl::sycl::queue& q, P& partials, Out& out,
+                                             size_t length, size_t maxLocal, size_t units, C bop, const R& init, Make make,
+                                             const cl::sycl::kernel* vecKernel, const cl::sycl::kernel* scalarKernel,
+                                             const cl::sycl::kernel* partialKernel,
+                                             const std::vector<cl::sycl::event>& deps, In&... in){
+        using Mem = typename reduction_memory<P>::type;
+
+        bool vectorize = (N > 1) && (length >= N);
+        size_t items = vectorize ? length / N : length;
+
+        /* The number of groups follows the compute units, is capped so that
+         * every work-item owns at least one element, and never exceeds the
+         * work-group size, so that the second pass fits in a single
+         * work-group. */
+        size_t local = std::min(maxLocal, items);
+        size_t groups = std::min({ units * groups_per_compute_unit, items / local, local });
+        bool single = (groups == 1);
+
+        cl::sycl::event e;
+        if(vectorize){
+            using Name = sycl_reduction<T, C, N, Mem, X>;
+            if(single)    e = sycl_reduce_pass<Name, N>(q, out, length, 1, local, bop, true, init, vecKernel, deps, make, in...);
+            else          e = sycl_reduce_pass<Name, N>(q, partials, length, groups, local, bop, false, init, vecKernel, deps, make, in...);
+        }
+        else{
+            using Name = sycl_reduction<T, C, 1, Mem, X>;
+            if(single)    e = sycl_reduce_pass<Name, 1>(q, out, length, 1, local, bop, true, init, scalarKernel, deps, make, in...);
+            else          e = sycl_reduce_pass<Name, 1>(q, partials, length, groups, local, bop, false, init, scalarKernel, deps, make, in...);
+        }
+
+        /* At this point, you could queue::wait_and_throw() to ensure that
+         * errors are caught quickly. However, this would likely impact
+         * performance negatively. */
+        if(single)    return e;
+
+        return sycl_reduce_pass<sycl_reduction<R, C, 1, Mem>, 1>(q, out, groups, 1, groups, bop, true, init, partialKernel, { e },
+                                                                 unary_sources<R, R, no_transform>{}, partials);
+    }
+
+
+    /* Enqueues the complete reduction of the first `length` elements of in;
+     * see transform_reduce_enqueue. The scalar kernel serves both passes. */
+    template <typename T, typename C, typename In, typename P, typename Out>
+    cl::sycl::event sycl_reduce_enqueue(cl::sycl::queue& q, In& in, P& partials, Out& out,
+                                        size_t length, size_t maxLocal, size_t units, C bop, const T& init,
+                                        const cl::sycl::kernel* vecKernel = nullptr,
+                                        const cl::sycl::kernel* scalarKernel = nullptr,
+                                        const std::vector<cl::sycl::event>& deps = {}){
+        return transform_reduce_enqueue<T, no_transform, reduction_vector_width<T>::value>(
+            q, partials, out, length, maxLocal, units, bop, init, unary_sources<T, T, no_transform>{},
+            vecKernel, scalarKernel, scalarKernel, deps, in);
+    }
+
+
+    /* Number of independent accumulators in the host reduction loop. They
+     * break the dependency chain of bop, so the compiler can keep them in one
+     * SIMD register. */
+    constexpr int host_reduce_lanes = 8;
+
+    /* Fewest elements each host thread gets; below that, starting a thread
+     * costs more than it saves. */
+    constexpr size_t host_reduce_min_per_thread = size_t(1) << 15;
+
+
+    /* Reduces the length > 0 elements at data on the calling thread. */
+    template <typename T, typename C>
+    T host_reduce_serial(const T* data, size_t length, C bop){
+        if(length < 2 * host_reduce_lanes){
+            T acc = data[0];
+            for(size_t i = 1; i < length; i++)    acc = bop(acc, data[i]);
+            return acc;
+        }
+
+        T lanes[host_reduce_lanes];
+        for(int j = 0; j < host_reduce_lanes; j++)    lanes[j] = data[j];
+
+        size_t i = host_reduce_lanes;
+        for(; i + host_reduce_lanes <= length; i += host_reduce_lanes){
+            for(int j = 0; j < host_reduce_lanes; j++)    lanes[j] = bop(lanes[j], data[i + j]);
+        }
+
+        T acc = lanes[0];
+        for(int j = 1; j < host_reduce_lanes; j++)    acc = bop(acc, lanes[j]);
+        for(; i < length; i++)    acc = bop(acc, data[i]);
+        return acc;
+    }
+
+
+    /* Reduces the elements at data on the host and folds the result into init.
+     * The input is split into one contiguous range per hardware thread, as
+     * long as each range holds at least host_reduce_min_per_thread elements. */
+    template <typename T, typename C>
+    T host_reduce(const T* data, size_t length, T init, C bop){
+        if(length == 0)    return init;
+
+        size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+        size_t threads = std::min(hardware, std::max<size_t>(1, length / host_reduce_min_per_thread));
+        if(threads == 1)    return bop(init, host_reduce_serial(data, length, bop));
+
+        size_t chunk = (length + threads - 1) / threads;
+        std::vector<T> partials(threads, init);
+        std::vector<std::thread> workers;
+        for(size_t t = 1; t < threads; t++){
+            size_t begin = t * chunk;
+            size_t end = std::min(begin + chunk, length);
+            workers.emplace_back([&partials, data, begin, end, t, bop]{
+                partials[t] = host_reduce_serial(data + begin, end - begin, bop);
+            });
+        }
+        partials[0] = host_reduce_serial(data, chunk, bop);
+        for(auto& w : workers)    w.join();
+
+        for(auto& p : partials)    init = bop(init, p);
+        return init;
+    }
+
+
+    /* Long-lived reduction object for repeated reductions with the same
+     * operator. The queue, the built kernels, the device limits and the
+     * device-side scratch memory are set up once, so later calls only pay for
+     * the kernels themselves and, for host data, the input transfer. The
+     * input buffer grows on demand and is reused for inputs of the same or
+     * smaller size.
+     * Besides host vectors, a reducer takes data that already lives on the
+     * device, in a buffer or in a USM device allocation. Those reductions write
+     * their result to the device and return the event of the last kernel
+     * without waiting, so they can be chained into later work.
+     * Host vectors shorter than crossover() are reduced on the host instead,
+     * where no launch or transfer overhead applies. The crossover is measured
+     * on first use and cached for every reducer of the same T and Op on the
+     * same device; set_crossover() overrides it. */
+    template <typename T, typename Op>
+    class reducer{
+    public:
+        explicit reducer(cl::sycl::queue q, Op bop = Op{})
+            : _q(q), _bop(bop),
+              _vecKernel(build_kernel<reduction_vector_width<T>::value, buffer_memory>()),
+              _scalarKernel(build_kernel<1, buffer_memory>()),
+              _local(reduction_local_size<T>(q.get_device())),
+              _units(q.get_device().template get_info<cl::sycl::info::device::max_compute_units>()),
+              _bufP(cl::sycl::range<1>(_local)),
+              _bufR(cl::sycl::range<1>(1)){
+        }
+
+        /* The reducer owns USM scratch memory, so it is not copied. */
+        reducer(const reducer&) = delete;
+        reducer& operator=(const reducer&) = delete;
+
+        ~reducer(){
+            if(_usmP){
+                _usmLast.wait();
+                cl::sycl::experimental::free(_usmP, _q);
+            }
+        }
+
+        /* Reduces v and folds the result into init, on the host or on the
+         * device depending on crossover(). */
+        T reduce(const std::vector<T>& v, const T& init){
+            if(v.size() < crossover())    return reduce_on_host(v, init);
+            return reduce_on_device(v, init);
+        }
+
+        /* Reduces v on the host with SIMD-friendly loops and one thread per
+         * core. */
+        T reduce_on_host(const std::vector<T>& v, const T& init) const{
+            return host_reduce(v.data(), v.size(), init, _bop);
+        }
+
+        /* Reduces v on the device, whatever its size. */
+        T reduce_on_device(const std::vector<T>& v, const T& init){
+            size_t length = v.size();
+
+            if(length == 0)    return init;
+            if(length == 1)    return _bop(init, v[0]);
+
+            reserve(length);
+
+            /* Only the used part of the pooled buffer is overwritten, so the
+             * runtime does not need to preserve or transfer the rest. */
+            _q.submit([&](cl::sycl::handler& h){
+                auto aI = _bufI->template get_access<cl::sycl::access::mode::discard_write>(h, cl::sycl::range<1>(length));
+                h.copy(v.data(), aI);
+            });
+
+            sycl_reduce_enqueue(_q, *_bufI, _bufP, _bufR, length, _local, _units, _bop, init,
+                                &_vecKernel->kernel, &_scalarKernel->kernel);
+            auto hR = _bufR.template get_access<cl::sycl::access::mode::read>();
+            return hR[0];
+        }
+
+        /* Reduces all elements of in, folds the result into init and writes it
+         * to out[0]. Nothing is copied to or from the host. */
+        cl::sycl::event reduce(cl::sycl::buffer<T, 1>& in, cl::sycl::buffer<T, 1>& out, const T& init){
+            size_t length = in.get_count();
+
+            if(length == 0){
+                return _q.submit([&](cl::sycl::handler& h){
+                    auto aO = out.template get_access<cl::sycl::access::mode::discard_write>(h, cl::sycl::range<1>(1));
+                    h.fill(aO, init);
+                });
+            }
+
+            return sycl_reduce_enqueue(_q, in, _bufP, out, length, _local, _units, _bop, init,
+                                       &_vecKernel->kernel, &_scalarKernel->kernel);
+        }
+
+        /* Reduces the `length` elements at the USM device pointer in, folds the
+         * result into init and writes it to *out, which is USM device memory
+         * as well. The reduction starts once deps have completed. */
+        cl::sycl::event reduce(const T* in, size_t length, T* out, const T& init,
+                               const std::vector<cl::sycl::event>& deps = {}){
+            /* Reductions share the USM scratch memory, so each one also waits
+             * for the previous one. */
+            std::vector<cl::sycl::event> after(deps);
+            if(_usmP)    after.push_back(_usmLast);
+            else{
+                _usmP = cl::sycl::experimental::malloc_device<T>(_local, _q);
+                _usmVecKernel = build_kernel<reduction_vector_width<T>::value, usm_memory>();
+                _usmScalarKernel = build_kernel<1, usm_memory>();
+            }
+
+            if(length == 0){
+                _usmLast = _q.submit([&](cl::sycl::handler& h){
+                    h.depends_on(after);
+                    h.fill(out, init, 1);
+                });
+            }
+            else{
+                _usmLast = sycl_reduce_enqueue(_q, in, _usmP, out, length, _local, _units, _bop, init,
+                                               &_usmVecKernel->kernel, &_usmScalarKernel->kernel, after);
+            }
+            return _usmLast;
+        }
+
+        /* Makes sure inputs of up to n elements can be reduced without
+         * allocating device memory. */
+        void reserve(size_t n){
+            if(_bufI && _bufI->get_count() >= n)    return;
+            size_t capacity = _bufI ? std::max(n, 2 * _bufI->get_count()) : n;
+            _bufI.reset(new cl::sycl::buffer<T, 1>(cl::sycl::range<1>(capacity)));
+        }
+
+        cl::sycl::queue& get_queue(){ return _q; }
+
+        /* Smallest host vector that reduce() sends to the device. It is
+         * measured the first time it is needed, unless it was set. */
+        size_t crossover(){
+            if(!_crossoverKnown){
+                std::string key = device_key();
+                std::lock_guard<std::mutex> lock(crossover_mutex());
+
+                auto& cache = crossover_cache();
+                auto it = cache.find(key);
+                if(it == cache.end())    it = cache.emplace(key, measure_crossover()).first;
+
+                _crossover = it->second;
+                _crossoverKnown = true;
+            }
+            return _crossover;
+        }
+
+        /* Overrides the crossover of this reducer; 0 sends every input to the
+         * device. */
+        void set_crossover(size_t n){
+            _crossover = n;
+            _crossoverKnown = true;
+        }
+
+        /* Largest work-group size used by the kernels. */
+        size_t local_size() const{ return _local; }
+
+        /* Number of elements the pooled input buffer can hold. */
+        size_t capacity() const{ return _bufI ? _bufI->get_count() : 0; }
+
+    private:
+        /* Times host and device reductions of growing inputs and returns the
+         * first size at which the device is faster. Each size is timed as the
+         * best of a few runs, after one untimed run on the device. If the host
+         * wins throughout, or a device run exceeds the time budget, the
+         * crossover lies beyond the last size tried. */
+        size_t measure_crossover(){
+            constexpr size_t smallest = size_t(1) << 10;
+            constexpr size_t largest = size_t(1) << 22;
+            constexpr int runs = 3;
+            constexpr double budget = 0.25;
+
+            std::vector<T> sample(largest, T{});
+            auto best = [](auto f){
+                double fastest = std::numeric_limits<double>::max();
+                for(int r = 0; r < runs; r++){
+                    auto start = std::chrono::steady_clock::now();
+                    f();
+                    auto end = std::chrono::steady_clock::now();
+                    fastest = std::min(fastest, std::chrono::duration<double>(end - start).count());
+                }
+                return fastest;
+            };
+
+            size_t n = smallest;
+            for(; n <= largest; n *= 4){
+                std::vector<T> v(sample.begin(), sample.begin() + n);
+                reduce_on_device(v, T{});
+
+                double host = best([&]{ reduce_on_host(v, T{}); });
+                double device = best([&]{ reduce_on_device(v, T{}); });
+                if(device < host)    return n;
+                if(device > budget)    return n * 4;
+            }
+            return n;
+        }
+
+        std::string device_key() const{
+            auto device = _q.get_device();
+            return device.template get_info<cl::sycl::info::device::name>() + '/' +
+                   device.get_platform().template get_info<cl::sycl::info::platform::name>();
+        }
+
+        static std::map<std::string, size_t>& crossover_cache(){
+            static std::map<std::string, size_t> cache;
+            return cache;
+        }
+
+        static std::mutex& crossover_mutex(){
+            static std::mutex m;
+            return m;
+        }
+
+        /* A program can only be built once, so each kernel gets its own. */
+        struct prebuilt{
+            cl::sycl::program program;
+            cl::sycl::kernel kernel;
+        };
+
+        template <int N, typename Mem>
+        std::unique_ptr<prebuilt> build_kernel(){
+            cl::sycl::program program(_q.get_context());
+            program.template build_with_kernel_type<sycl_reduction<T, Op, N, Mem>>();
+            auto kernel = program.template get_kernel<sycl_reduction<T, Op, N, Mem>>();
+            return std::unique_ptr<prebuilt>(new prebuilt{ program, kernel });
+        }
+
+        cl::sycl::queue _q;
+        Op _bop;
+        std::unique_ptr<prebuilt> _vecKernel;
+        std::unique_ptr<prebuilt> _scalarKernel;
+        std::unique_ptr<prebuilt> _usmVecKernel;
+        std::unique_ptr<prebuilt> _usmScalarKernel;
+        size_t _local;
+        size_t _units;
+        cl::sycl::buffer<T, 1> _bufP;
+        cl::sycl::buffer<T, 1> _bufR;
+        std::unique_ptr<cl::sycl::buffer<T, 1>> _bufI;
+        T* _usmP = nullptr;
+        cl::sycl::event _usmLast;
+        size_t _crossover = 0;
+        bool _crossoverKnown = false;
+    };
+
+
+    /* Returns a queue on the default device that reports asynchronous
+     * exceptions of the reduction kernels. */
+    inline cl::sycl::queue reduction_queue(){
+        return cl::sycl::queue([=](cl::sycl::exception_list eL){
+            try{
+                for(auto& e : eL)    std::rethrow_exception(e);
+            } catch (cl::sycl::exception ex){
+                std::cout << " There is an exception in the reduction kernel\n";
+                std::cout << ex.what() << '\n';
+            }
+        });
+    }
+
+
+    /* Reduces v with the associative and commutative binary operator bop and
+     * folds the result into init. Any length is supported. The first pass
+     * launches a number of work-groups proportional to the device's compute
+     * units, and a second single work-group pass combines their partial
+     * results, so at most two kernels are enqueued. */
     template <typename T, typename I, typename C>
     T sycl_reduce(const std::vector<T>& v, I& init, C bop){
+        size_t length = v.size();
+
+        if(length == 0)    return init;
+        if(length == 1)    return bop(init, v[0]);
+
         T retVal;
 
         {
-            cl::sycl::queue q([=](cl::sycl::exception_list eL){
-                try{
-                    for(auto& e : eL)    std::rethrow_exception(e);
-                } catch (cl::sycl::exception ex){
-                    std::cout << " There is an exception in the reduction kernel\n";
-                    std::cout << ex.what() << '\n';
-                }
-            });
+            cl::sycl::queue q = reduction_queue();
 
             /* Output device and platform information. */
             auto device = q.get_device();
@@ -60,82 +784,618 @@ namespace chiu{
             auto platformName = device.get_platform().get_info<cl::sycl::info::platform::name>();
             std::cout << "Platform Name " << platformName << '\n';
 
+            size_t local = reduction_local_size<T>(device);
+            size_t units = device.get_info<cl::sycl::info::device::max_compute_units>();
+
             /* The buffer is used to initialise the data on the device, but we don't
              * want to copy back and trash it. buffer::set_final_data() tells the
              * SYCL runtime where to put the data when the buffer is destroyed; nullptr
-             * indicates not to copy back. The vector's length is used as the global
-             * work size (unless that is too large). */
-            cl::sycl::buffer<int, 1> bufI(v.data(), cl::sycl::range<1>(v.size()));
+             * indicates not to copy back. */
+            cl::sycl::buffer<T, 1> bufI(v.data(), cl::sycl::range<1>(length));
             bufI.set_final_data(nullptr);
-        
-            size_t local = std::min(v.size(), device.get_info<cl::sycl::info::device::max_work_group_size>());
-            size_t length = v.size();
+            cl::sycl::buffer<T, 1> bufP{ cl::sycl::range<1>(local) };
+            cl::sycl::buffer<T, 1> bufR{ cl::sycl::range<1>(1) };
 
-            if(length == 0)    return init;
-            if(length == 1)    return bop(init, v[0]);
+            sycl_reduce_enqueue(q, bufI, bufP, bufR, length, local, units, bop, T(init));
 
             {
-                /* Each iteration of the do loop applies one level of reduction until
-                 * the input is of length 1 (i.e. the reduction is complete). */
-                do{
-                    auto f = [length, local, &bufI, bop](cl::sycl::handler& h) mutable{
-                        cl::sycl::nd_range<1> r{ cl::sycl::range<1>{ std::max(length, local) }, cl::sycl::range<1>{ std::min(length, local) } };
-
-                        /* Two accessors are used: one to the buffer that is being reduced,
-                         * and a second to local memory, used to store intermediate data. */
-                        auto aI = bufI.template get_access<cl::sycl::access::mode::read_write>(h);
-                        cl::sycl::accessor<T, 1, cl::sycl::access::mode::read_write, 
-                                                 cl::sycl::access::target::local> scratch(cl::sycl::range<1>(local), h);
-
-                        /* The parallel_for invocation chosen is the variant with an nd_item
-                         * parameter, since the code requires barriers for correctness. */
-                        h.parallel_for<sycl_reduction<T>>(r, [aI, scratch, local, length, bop](cl::sycl::nd_item<1> id){
-                            size_t globalid = id.get_global_id(0);
-                            size_t localid = id.get_local_id(0);
-
-                            /* All threads collectively read from global memory into local.
-                             * The barrier ensures all threads' IO is resolved before
-                             * execution continues (strictly speaking, all threads within
-                             * a single work-group - there is no co-ordination between
-                             * work-groups, only work-items). */
-                            if(globalid < length)    scratch[localid] = aI[globalid];
-            
+                /* It is always sensible to wrap host accessors in their own scope as
+                 * kernels using the buffers they access are blocked for the length
+                 * of the accessor's lifetime. */
+                auto hR = bufR.template get_access<cl::sycl::access::mode::read>();
+                retVal = hR[0];
+            }
+        }
+
+        return retVal;
+    }
+
+
+    /* Applies tf to every element of v, reduces the results with bop and folds
+     * them into init, whose type R is the type of the result. tf runs in the
+     * load stage of the reduction kernel, so the transformed values are never
+     * written to global memory. */
+    template <typename T, typename R, typename C, typename U>
+    R transform_reduce(const std::vector<T>& v, R init, C bop, U tf){
+        size_t length = v.size();
+
+        if(length == 0)    return init;
+
+        cl::sycl::queue q = reduction_queue();
+        auto device = q.get_device();
+        size_t local = reduction_local_size<R>(device);
+        size_t units = device.get_info<cl::sycl::info::device::max_compute_units>();
+
+        cl::sycl::buffer<T, 1> bufI(v.data(), cl::sycl::range<1>(length));
+        bufI.set_final_data(nullptr);
+        cl::sycl::buffer<R, 1> bufP{ cl::sycl::range<1>(local) };
+        cl::sycl::buffer<R, 1> bufR{ cl::sycl::range<1>(1) };
+
+        transform_reduce_enqueue<T, unary_transform<R, U>, reduction_vector_width<T>::value>(
+            q, bufP, bufR, length, local, units, bop, init, unary_sources<T, R, U>{ tf },
+            nullptr, nullptr, nullptr, {}, bufI);
+
+        auto hR = bufR.template get_access<cl::sycl::access::mode::read>();
+        return hR[0];
+    }
+
+
+    /* Applies tf to every pair of elements v1[i] and v2[i], reduces the results
+     * with bop and folds them into init, e.g. a dot product with std::plus and
+     * std::multiplies. v2 needs at least as many elements as v1, otherwise
+     * std::invalid_argument is thrown. Vector loads are as wide as the
+     * narrower of the two element types allows. */
+    template <typename T1, typename T2, typename R, typename C, typename B>
+    R transform_reduce(const std::vector<T1>& v1, const std::vector<T2>& v2, R init, C bop, B tf){
+        size_t length = v1.size();
+
+        if(v2.size() < length)    throw std::invalid_argument("transform_reduce: v2 is shorter than v1");
+
+        if(length == 0)    return init;
+
+        cl::sycl::queue q = reduction_queue();
+        auto device = q.get_device();
+        size_t local = reduction_local_size<R>(device);
+        size_t units = device.get_info<cl::sycl::info::device::max_compute_units>();
+
+        cl::sycl::buffer<T1, 1> bufI1(v1.data(), cl::sycl::range<1>(length));
+        bufI1.set_final_data(nullptr);
+        cl::sycl::buffer<T2, 1> bufI2(v2.data(), cl::sycl::range<1>(length));
+        bufI2.set_final_data(nullptr);
+        cl::sycl::buffer<R, 1> bufP{ cl::sycl::range<1>(local) };
+        cl::sycl::buffer<R, 1> bufR{ cl::sycl::range<1>(1) };
+
+        constexpr int N = std::min(reduction_vector_width<T1>::value, reduction_vector_width<T2>::value);
+        transform_reduce_enqueue<T1, binary_transform<T2, R, B>, N>(
+            q, bufP, bufR, length, local, units, bop, init, binary_sources<T1, T2, R, B>{ tf },
+            nullptr, nullptr, nullptr, {}, bufI1, bufI2);
+
+        auto hR = bufR.template get_access<cl::sycl::access::mode::read>();
+        return hR[0];
+    }
+
+
+    /* Piece of a long segment that one work-group of segmented_reduce reduces.
+     * If it is the only piece of its segment, sole is set and the work-group
+     * writes the result of the segment directly. */
+    struct segment_chunk{
+        size_t begin;
+        size_t end;
+        size_t segment;
+        bool sole;
+    };
+
+
+    /* Long segment whose count pieces start at chunk first. */
+    struct segment_pieces{
+        size_t segment;
+        size_t first;
+        size_t count;
+    };
+
+
+    /* Read-only buffer over the elements of v. Buffers cannot be empty, so an
+     * empty v gets an uninitialized one-element buffer instead of one that
+     * would copy from its data pointer. */
+    template <typename U>
+    cl::sycl::buffer<U, 1> segmented_input_buffer(const std::vector<U>& v){
+        if(v.empty())    return cl::sycl::buffer<U, 1>{ cl::sycl::range<1>(1) };
+
+        cl::sycl::buffer<U, 1> buf(v.data(), cl::sycl::range<1>(v.size()));
+        buf.set_final_data(nullptr);
+        return buf;
+    }
+
+
+    /* Reduces every segment [offsets[s], offsets[s + 1]) of values with bop
+     * and folds it into init, so an empty segment yields init. The segments
+     * are assigned by size: short ones go to a single work-item each, long ones
+     * are cut into chunks that each get a whole work-group. All segments are
+     * handled in one launch, plus a second one if a segment spans several
+     * chunks. */
+    template <typename T, typename C>
+    std::vector<T> segmented_reduce(const std::vector<T>& values, const std::vector<size_t>& offsets, C bop, T init){
+        size_t segments = offsets.empty() ? 0 : offsets.size() - 1;
+        std::vector<T> result(segments, init);
+
+        if(segments == 0)    return result;
+
+        cl::sycl::queue q = reduction_queue();
+        size_t local = reduction_local_size<T>(q.get_device());
+        size_t chunk = local * segmented_items_per_work_item;
+
+        /* The segments are sorted into work on the host; this only walks the
+         * offsets and never touches the values. */
+        std::vector<size_t> smalls;
+        std::vector<segment_chunk> chunks;
+        std::vector<segment_pieces> pieces;
+        for(size_t s = 0; s < segments; s++){
+            size_t begin = offsets[s];
+            size_t end = offsets[s + 1];
+
+            if(end - begin <= segmented_small_segment){
+                smalls.push_back(s);
+                continue;
+            }
+
+            size_t count = (end - begin + chunk - 1) / chunk;
+            if(count > 1)    pieces.push_back({ s, chunks.size(), count });
+            for(size_t b = begin; b < end; b += chunk)    chunks.push_back({ b, std::min(b + chunk, end), s, count == 1 });
+        }
+
+        size_t nChunks = chunks.size();
+        size_t nSmalls = smalls.size();
+        size_t groups = nChunks + (nSmalls + local - 1) / local;
+
+        {
+            /* Unused buffers hold a single uninitialized element. */
+            cl::sycl::buffer<T, 1> bufV = segmented_input_buffer(values);
+            cl::sycl::buffer<size_t, 1> bufOff = segmented_input_buffer(offsets);
+            cl::sycl::buffer<size_t, 1> bufS = segmented_input_buffer(smalls);
+            cl::sycl::buffer<segment_chunk, 1> bufC = segmented_input_buffer(chunks);
+            cl::sycl::buffer<T, 1> bufP{ cl::sycl::range<1>(std::max<size_t>(nChunks, 1)) };
+            cl::sycl::buffer<T, 1> bufO(result.data(), cl::sycl::range<1>(segments));
+
+            q.submit([&](cl::sycl::handler& h){
+                auto aV = bufV.template get_access<cl::sycl::access::mode::read>(h);
+                auto aOff = bufOff.template get_access<cl::sycl::access::mode::read>(h);
+                auto aS = bufS.template get_access<cl::sycl::access::mode::read>(h);
+                auto aC = bufC.template get_access<cl::sycl::access::mode::read>(h);
+                auto aP = bufP.template get_access<cl::sycl::access::mode::discard_write>(h);
+                auto aO = bufO.template get_access<cl::sycl::access::mode::write>(h);
+                cl::sycl::accessor<T, 1, cl::sycl::access::mode::read_write,
+                                         cl::sycl::access::target::local> scratch(cl::sycl::range<1>(local), h);
+
+                size_t half = next_pow2(local) / 2;
+                cl::sycl::nd_range<1> r{ cl::sycl::range<1>{ groups * local }, cl::sycl::range<1>{ local } };
+
+                /* The first nChunks work-groups reduce one chunk each, the
+                 * remaining ones reduce local short segments each. The branch
+                 * is uniform within a work-group, so the barriers are safe. */
+                h.parallel_for<sycl_segmented_reduction<T, C>>(r, [aV, aOff, aS, aC, aP, aO, scratch, local, half, nChunks, nSmalls, bop, init](cl::sycl::nd_item<1> id){
+                    size_t group = id.get_group(0);
+                    size_t localid = id.get_local_id(0);
+
+                    if(group < nChunks){
+                        segment_chunk c = aC[group];
+                        size_t count = std::min(local, c.end - c.begin);
+
+                        if(localid < count){
+                            T acc = aV[c.begin + localid];
+                            for(size_t i = c.begin + localid + local; i < c.end; i += local)    acc = bop(acc, aV[i]);
+                            scratch[localid] = acc;
+                        }
+                        id.barrier(cl::sycl::access::fence_space::local_space);
+
+                        for(size_t offset = half; offset > 0; offset /= 2){
+                            if(localid < offset && localid + offset < count)    scratch[localid] = bop(scratch[localid], scratch[localid + offset]);
                             id.barrier(cl::sycl::access::fence_space::local_space);
+                        }
 
-                            /* Apply the reduction operation between the current local
-                             * id and the one on the other half of the vector. */
-                            if(globalid < length){
-                                int min = (length < local) ? length : local;
-                                for(size_t offset = min / 2; offset > 0; offset /= 2){
-                                    if(localid < offset)    scratch[localid] = bop(scratch[localid], scratch[localid + offset]);
-                                    id.barrier(cl::sycl::access::fence_space::local_space);
-                                }
-                  
-                                /* The final result will be stored in local id 0. */
-                                if(localid == 0)    aI[id.get_group(0)] = scratch[localid];
-                            }   
-                        });
-                    };
+                        if(localid == 0){
+                            if(c.sole)    aO[c.segment] = bop(init, scratch[0]);
+                            else          aP[group] = scratch[0];
+                        }
+                    }
+                    else{
+                        size_t k = (group - nChunks) * local + localid;
+                        if(k < nSmalls){
+                            size_t s = aS[k];
+                            T acc = init;
+                            for(size_t i = aOff[s]; i < aOff[s + 1]; i++)    acc = bop(acc, aV[i]);
+                            aO[s] = acc;
+                        }
+                    }
+                });
+            });
 
-                    q.submit(f);
+            /* Segments that were cut into several chunks fold their partial
+             * results, one work-item per segment. */
+            if(!pieces.empty()){
+                cl::sycl::buffer<segment_pieces, 1> bufPieces(pieces.data(), cl::sycl::range<1>(pieces.size()));
+                bufPieces.set_final_data(nullptr);
 
-                    /* At this point, you could queue::wait_and_throw() to ensure that
-                     * errors are caught quickly. However, this would likely impact
-                     * performance negatively. */                
-                    length = length / local;
+                q.submit([&](cl::sycl::handler& h){
+                    auto aPieces = bufPieces.template get_access<cl::sycl::access::mode::read>(h);
+                    auto aP = bufP.template get_access<cl::sycl::access::mode::read>(h);
+                    auto aO = bufO.template get_access<cl::sycl::access::mode::write>(h);
 
-                } while(length > 1);
+                    h.parallel_for<sycl_segmented_combine<T, C>>(cl::sycl::range<1>(pieces.size()), [aPieces, aP, aO, bop, init](cl::sycl::id<1> i){
+                        segment_pieces p = aPieces[i];
+                        T acc = init;
+                        for(size_t j = p.first; j < p.first + p.count; j++)    acc = bop(acc, aP[j]);
+                        aO[p.segment] = acc;
+                    });
+                });
             }
+        }
 
-            {
-                /* It is always sensible to wrap host accessors in their own scope as
-                 * kernels using the buffers they access are blocked for the length
-                 * of the accessor's lifetime. */
-                auto hI = bufI.template get_access<cl::sycl::access::mode::read>();
-                retVal = bop(init, hI[0]);
+        return result;
+    }
+
+
+    /* An element together with its index, the result of argmin and argmax. */
+    template <typename T>
+    struct indexed_value{
+        T value;
+        size_t index;
+    };
+
+
+    /* Operators for reduce_many that find the smallest or the largest element
+     * and its index. Ties go to the lowest index. */
+    template <typename T>
+    struct argmin{
+        indexed_value<T> operator()(indexed_value<T> a, indexed_value<T> b) const{
+            return (b.value < a.value || (!(a.value < b.value) && b.index < a.index)) ? b : a;
+        }
+    };
+
+    template <typename T>
+    struct argmax{
+        indexed_value<T> operator()(indexed_value<T> a, indexed_value<T> b) const{
+            return (a.value < b.value || (!(b.value < a.value) && b.index < a.index)) ? b : a;
+        }
+    };
+
+
+    /* Operator for reduce_many that counts the elements. */
+    struct count{
+        size_t operator()(size_t a, size_t b) const{ return a + b; }
+    };
+
+
+    /* The identity element of a binary operator on T. */
+    template <typename T, typename Op>
+    struct reduction_identity{};
+
+    template <typename T>
+    struct reduction_identity<T, std::plus<T>>{
+        static constexpr T value = static_cast<T>(0);
+    };
+
+    template <typename T>
+    struct reduction_identity<T, std::multiplies<T>>{
+        static constexpr T value = static_cast<T>(1);
+    };
+
+    template <typename T>
+    struct reduction_identity<T, std::bit_and<T>>{
+        static constexpr T value = static_cast<T>(~static_cast<T>(0));
+    };
+
+    template <typename T>
+    struct reduction_identity<T, std::bit_or<T>>{
+        static constexpr T value = static_cast<T>(0);
+    };
+
+    template <typename T>
+    struct reduction_identity<T, std::bit_xor<T>>{
+        static constexpr T value = static_cast<T>(0);
+    };
+
+    template <typename T>
+    struct reduction_identity<T, minimum<T>>{
+        static constexpr T value = minimum<T>::identity;
+    };
+
+    template <typename T>
+    struct reduction_identity<T, maximum<T>>{
+        static constexpr T value = maximum<T>::identity;
+    };
+
+
+    /* How reduce_many applies Op to elements of T: the type of the
+     * accumulator, its identity, and the accumulator of the single element x
+     * at index i. By default Op is a binary operator on T with a
+     * reduction_identity. */
+    template <typename T, typename Op>
+    struct many_traits{
+        using type = T;
+        static type identity(){ return reduction_identity<T, Op>::value; }
+        static type lift(const T& x, size_t){ return x; }
+    };
+
+    template <typename T>
+    struct many_traits<T, argmin<T>>{
+        using type = indexed_value<T>;
+        static type identity(){ return { reduction_identity<T, minimum<T>>::value, std::numeric_limits<size_t>::max() }; }
+        static type lift(const T& x, size_t i){ return { x, i }; }
+    };
+
+    template <typename T>
+    struct many_traits<T, argmax<T>>{
+        using type = indexed_value<T>;
+        static type identity(){ return { reduction_identity<T, maximum<T>>::value, std::numeric_limits<size_t>::max() }; }
+        static type lift(const T& x, size_t i){ return { x, i }; }
+    };
+
+    template <typename T>
+    struct many_traits<T, count>{
+        using type = size_t;
+        static type identity(){ return 0; }
+        static type lift(const T&, size_t){ return 1; }
+    };
+
+
+    /* Accumulators of several operators, kept in one struct so that a single
+     * local array holds all of them. */
+    template <typename... A>
+    struct many;
+
+    template <>
+    struct many<>{};
+
+    template <typename A, typename... Rest>
+    struct many<A, Rest...>{
+        A head;
+        many<Rest...> tail;
+    };
+
+
+    /* Applies all operators of reduce_many at once. It is the binary operator
+     * of the reduction over many accumulators, and lifts an element of T into
+     * them. */
+    template <typename T, typename... Ops>
+    struct many_op;
+
+    template <typename T>
+    struct many_op<T>{
+        using type = many<>;
+
+        type operator()(const type&, const type&) const{ return {}; }
+        type lift(const T&, size_t) const{ return {}; }
+        type identity() const{ return {}; }
+    };
+
+    template <typename T, typename Op, typename... Rest>
+    struct many_op<T, Op, Rest...>{
+        using type = many<typename many_traits<T, Op>::type, typename many_traits<T, Rest>::type...>;
+
+        Op op;
+        many_op<T, Rest...> rest;
+
+        many_op(Op o, Rest... r) : op(o), rest(r...){}
+
+        type operator()(const type& a, const type& b) const{ return { op(a.head, b.head), rest(a.tail, b.tail) }; }
+        type lift(const T& x, size_t i) const{ return { many_traits<T, Op>::lift(x, i), rest.lift(x, i) }; }
+        type identity() const{ return { many_traits<T, Op>::identity(), rest.identity() }; }
+    };
+
+
+    /* Element source of reduce_many. Element i is the accumulators of aI[i];
+     * see unary_source for the vector loads. */
+    template <typename T, typename A, typename M>
+    struct many_source{
+        A aI;
+        M m;
+
+        typename M::type operator[](size_t i) const{ return m.lift(aI[i], i); }
+
+        template <int N, typename C>
+        typename M::type load(size_t i, C bop) const{
+            if constexpr(N == 1 || is_usm_wrapper<A>::value){
+                auto acc = (*this)[i * N];
+                for(int j = 1; j < N; j++)    acc = bop(acc, (*this)[i * N + j]);
+                return acc;
+            }
+            else{
+                T lanes[N];
+                sycl_reduce_lanes<N>(aI, i, lanes);
+
+                auto acc = m.lift(lanes[0], i * N);
+                for(int j = 1; j < N; j++)    acc = bop(acc, m.lift(lanes[j], i * N + j));
+                return acc;
             }
         }
+    };
 
-        return retVal;
+    template <typename T, typename M>
+    struct many_sources{
+        M m;
+
+        template <typename A>
+        many_source<T, A, M> operator()(A a) const{ return { a, m }; }
+    };
+
+
+    inline std::tuple<> many_to_tuple(const many<>&){ return {}; }
+
+    template <typename A, typename... Rest>
+    std::tuple<A, Rest...> many_to_tuple(const many<A, Rest...>& m){
+        return std::tuple_cat(std::make_tuple(m.head), many_to_tuple(m.tail));
+    }
+
+
+    /* Reduces v with every operator of ops while reading v only once, e.g.
+     * reduce_many(v, std::make_tuple(std::plus<T>{}, minimum<T>{}, maximum<T>{})).
+     * Besides binary operators with a reduction_identity, ops can hold argmin,
+     * argmax and count. Returns one result per operator, in order; an empty v
+     * yields the identities. */
+    template <typename T, typename... Ops>
+    std::tuple<typename many_traits<T, Ops>::type...> reduce_many(const std::vector<T>& v, const std::tuple<Ops...>& ops){
+        using M = many_op<T, Ops...>;
+        using R = typename M::type;
+
+        M m = std::apply([](const Ops&... o){ return M(o...); }, ops);
+        size_t length = v.size();
+
+        if(length == 0)    return many_to_tuple(m.identity());
+
+        cl::sycl::queue q = reduction_queue();
+        auto device = q.get_device();
+        size_t local = reduction_local_size<R>(device);
+        size_t units = device.get_info<cl::sycl::info::device::max_compute_units>();
+
+        cl::sycl::buffer<T, 1> bufI(v.data(), cl::sycl::range<1>(length));
+        bufI.set_final_data(nullptr);
+        cl::sycl::buffer<R, 1> bufP{ cl::sycl::range<1>(local) };
+        cl::sycl::buffer<R, 1> bufR{ cl::sycl::range<1>(1) };
+
+        transform_reduce_enqueue<T, unary_transform<R, M>, reduction_vector_width<T>::value>(
+            q, bufP, bufR, length, local, units, m, m.identity(), many_sources<T, M>{ m },
+            nullptr, nullptr, nullptr, {}, bufI);
+
+        auto hR = bufR.template get_access<cl::sycl::access::mode::read>();
+        return many_to_tuple(hR[0]);
+    }
+
+
+    /* Accumulator of a compensated sum; sum + c is much closer to the exact
+     * sum than sum alone. */
+    template <typename T>
+    struct neumaier{
+        T sum;
+        T c;
+    };
+
+
+    /* Accumulation rules for deterministic_reduce: type is the accumulator,
+     * lift turns an element into one, operator() combines two and result
+     * turns the final one back into a T. */
+    template <typename T, typename C>
+    struct plain_accumulation{
+        using type = T;
+
+        C bop;
+
+        type lift(T x) const{ return x; }
+        type operator()(type a, type b) const{ return bop(a, b); }
+        T result(type a) const{ return a; }
+    };
+
+    /* Neumaier's variant of Kahan summation. It also stays exact when the
+     * value added is larger than the running sum. */
+    template <typename T>
+    struct neumaier_accumulation{
+        using type = neumaier<T>;
+
+        type lift(T x) const{ return { x, T(0) }; }
+
+        type operator()(type a, type b) const{
+            T t = a.sum + b.sum;
+            T absA = a.sum < T(0) ? -a.sum : a.sum;
+            T absB = b.sum < T(0) ? -b.sum : b.sum;
+            T err = (absA >= absB) ? (a.sum - t) + b.sum : (b.sum - t) + a.sum;
+            return { t, a.c + b.c + err };
+        }
+
+        T result(type a) const{ return a.sum + a.c; }
+    };
+
+
+    /* Enqueues one pass of deterministic_reduce: work-item j folds values
+     * [j * deterministic_block, (j + 1) * deterministic_block) of bufIn from
+     * left to right. */
+    template <bool Lift, typename T, typename F, typename In>
+    void deterministic_pass(cl::sycl::queue& q, cl::sycl::buffer<In, 1>& bufIn, cl::sycl::buffer<typename F::type, 1>& bufOut,
+                            size_t length, F f){
+        using A = typename F::type;
+        size_t count = (length + deterministic_block - 1) / deterministic_block;
+
+        q.submit([&](cl::sycl::handler& h){
+            auto aI = bufIn.template get_access<cl::sycl::access::mode::read>(h);
+            auto aO = bufOut.template get_access<cl::sycl::access::mode::discard_write>(h, cl::sycl::range<1>(count));
+
+            h.parallel_for<sycl_deterministic_reduction<T, F, Lift>>(cl::sycl::range<1>(count), [aI, aO, length, f](cl::sycl::id<1> j){
+                auto lift = [f](In x) -> A{
+                    if constexpr(Lift)    return f.lift(x);
+                    else                  return x;
+                };
+
+                size_t begin = j[0] * deterministic_block;
+                size_t end = std::min(begin + deterministic_block, length);
+
+                A acc = lift(aI[begin]);
+                for(size_t i = begin + 1; i < end; i++)    acc = f(acc, lift(aI[i]));
+                aO[j] = acc;
+            });
+        });
+    }
+
+
+    /* Reduces the non-empty v with the accumulation f and returns the final
+     * accumulator. Every pass folds blocks of deterministic_block values in
+     * order, and the passes alternate between two buffers until one value is
+     * left. Nothing depends on the work-group size or the number of compute
+     * units. */
+    template <typename T, typename F>
+    typename F::type deterministic_fold(cl::sycl::queue& q, const std::vector<T>& v, F f){
+        using A = typename F::type;
+        size_t length = v.size();
+        size_t count = (length + deterministic_block - 1) / deterministic_block;
+
+        cl::sycl::buffer<T, 1> bufI(v.data(), cl::sycl::range<1>(length));
+        bufI.set_final_data(nullptr);
+        cl::sycl::buffer<A, 1> bufA{ cl::sycl::range<1>(count) };
+        cl::sycl::buffer<A, 1> bufB{ cl::sycl::range<1>((count + deterministic_block - 1) / deterministic_block) };
+
+        deterministic_pass<true, T>(q, bufI, bufA, length, f);
+
+        cl::sycl::buffer<A, 1>* in = &bufA;
+        cl::sycl::buffer<A, 1>* out = &bufB;
+        for(length = count; length > 1; length = (length + deterministic_block - 1) / deterministic_block){
+            deterministic_pass<false, T>(q, *in, *out, length, f);
+            std::swap(in, out);
+        }
+
+        auto hI = in->template get_access<cl::sycl::access::mode::read>();
+        return hI[0];
+    }
+
+
+    /* Reduces v with bop and folds the result into init, in an order that only
+     * depends on v.size(). For the same input, floating-point results are the
+     * same on every device and in every run, unlike sycl_reduce whose tree
+     * follows the device limits. */
+    template <typename T, typename C>
+    T deterministic_reduce(cl::sycl::queue& q, const std::vector<T>& v, T init, C bop){
+        if(v.empty())    return init;
+        plain_accumulation<T, C> f{ bop };
+        return bop(init, f.result(deterministic_fold(q, v, f)));
+    }
+
+    template <typename T, typename C>
+    T deterministic_reduce(const std::vector<T>& v, T init, C bop){
+        cl::sycl::queue q = reduction_queue();
+        return deterministic_reduce(q, v, init, bop);
+    }
+
+
+    /* Sums v and adds init with a compensated accumulator carried through the
+     * whole reduction. The order is that of deterministic_reduce, so the
+     * result is reproducible as well. */
+    template <typename T>
+    T compensated_sum(cl::sycl::queue& q, const std::vector<T>& v, T init){
+        if(v.empty())    return init;
+
+        neumaier_accumulation<T> f;
+        return f.result(f(f.lift(init), deterministic_fold(q, v, f)));
+    }
+
+    template <typename T>
+    T compensated_sum(const std::vector<T>& v, T init){
+        cl::sycl::queue q = reduction_queue();
+        return compensated_sum(q, v, init);
     }
 }
@@ -0,0 +1,96 @@
+/***************************************************************************
+ *
+ *  Copyright (C) 2016 Codeplay Software Limited
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  For your convenience, a copy of the License has been included in this
+ *  repository.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  Codeplay's ComputeCpp SDK
+ *
+ *  reduction_benchmark.cpp
+ *
+ *  Description:
+ *    Compares the sub-group and the unrolled work-group tails of
+ *    reduction_v5.hpp on the host and CPU devices.
+ *
+ **************************************************************************/
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include "benchmark.hpp"
+#include "reduction_v5.hpp"
+
+
+/* Runs `iterations` reductions of v with the given tail on q and returns the
+ * average time per reduction in milliseconds, or a negative value if a result
+ * is wrong. */
+double time_reduce(cl::sycl::queue& q, const std::vector<int>& v, int init, int expected,
+                   chiu::reduction_tail tail, int iterations){
+    /* The first run builds the kernel and is not timed. */
+    if(chiu::sycl_reduce(q, v, init, std::plus<int>{}, tail) != expected)    return -1.0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; i++){
+        if(chiu::sycl_reduce(q, v, init, std::plus<int>{}, tail) != expected)    return -1.0;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+
+/* Times both tails on q, skipping the sub-group tail if the device has no
+ * sub-groups. */
+void compare_tails(cl::sycl::queue& q, const std::vector<int>& v, int init, int expected,
+                   int iterations){
+    double unrolled = time_reduce(q, v, init, expected, chiu::reduction_tail::unrolled, iterations);
+    std::cout << "  unrolled tail:  " << unrolled << " ms\n";
+
+    if(!chiu::has_sub_groups(q.get_device())){
+        std::cout << "  sub-group tail: not supported\n";
+        return;
+    }
+
+    double subGroup = time_reduce(q, v, init, expected, chiu::reduction_tail::sub_group, iterations);
+    std::cout << "  sub-group tail: " << subGroup << " ms\n";
+}
+
+
+/* usage: ./reduction_benchmark [elements] [iterations] */
+int main(int argc, char* argv[]){
+    size_t N = (argc > 1) ? std::stoul(argv[1]) : 65536u;
+    int iterations = (argc > 2) ? std::stoi(argv[2]) : 5;
+    int init = 100;
+
+    std::random_device hwRand;
+    std::ranlux48 rand(hwRand());
+    std::uniform_int_distribution<int> dist(10, 150);
+
+    std::vector<int> v(N);
+    std::generate(v.begin(), v.end(), std::bind(dist, rand));
+
+    int expected = std::accumulate(v.begin(), v.end(), init);
+
+    std::cout << "Elements: " << N << ", iterations: " << iterations << '\n';
+    auto tails = [&](cl::sycl::queue& q){ compare_tails(q, v, init, expected, iterations); };
+    time_on("Host", cl::sycl::host_selector{}, tails);
+    time_on("CPU", cl::sycl::cpu_selector{}, tails);
+
+    return 0;
+}
@@ -25,19 +25,25 @@
  *
  **************************************************************************/
 
+#include <algorithm>
 #include <iostream>
 #include <random>
 #include <vector>
 #include <cassert>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
 #include "reduction.hpp"
+#include "reduction_v5.hpp"
 
 
 
 
-bool isPowerOfTwo(unsigned int x){
-  /* If x is a power of two, x & (x - 1) will be nonzero. */
-    return ((x != 0) && !(x & (x - 1)));
-}
+/* Transform for chiu::transform_reduce; like the binary operator, it names
+ * the kernel, so it is a function object type. */
+struct square{
+    long operator()(int x) const{ return static_cast<long>(x) * x; }
+};
 
 
 int main(int argc, char* argv[]){
@@ -45,11 +51,6 @@ int main(int argc, char* argv[]){
     int init = 100;
     //const unsigned N = 1048576u;
 
-    if(!isPowerOfTwo(N)){
-        std::cout << "The SYCL reduction example only works with vector sizes Power of Two \n";
-        return 1;
-    }
-
     std::random_device hwRand;
     std::ranlux48 rand(hwRand());
     std::uniform_int_distribution<int> dist(10, 150);
@@ -59,7 +60,9 @@ int main(int argc, char* argv[]){
     std::vector<int> v(N);
     std::generate(v.begin(), v.end(), f);
 
-    auto binaryop = [](unsigned a, unsigned b){ return a + b; };
+    /* The operator names the reduction kernel, so it is a function object
+     * type rather than a lambda. */
+    auto binaryop = std::plus<int>{};
 
     //auto resSycl = sycl_reduce(v, init, [=](unsigned a, unsigned b){ return a<b?a:b; });
     auto resSycl = chiu::sycl_reduce(v, init, binaryop);
@@ -70,6 +73,139 @@ int main(int argc, char* argv[]){
     std::cout << " STL Reduction result: " << resStl << '\n';
 
     assert(resSycl == resStl);
+
+    /* A reducer keeps its queue, kernel and buffers alive, so repeated
+     * reductions only pay for the transfer and the kernels. */
+    chiu::reducer<int, std::plus<int>> sum(cl::sycl::queue{});
+    for(int i = 0; i < 3; i++){
+        auto resReducer = sum.reduce(v, init);
+        assert(resReducer == resStl);
+    }
+    std::cout << "Reducer result: " << sum.reduce(v, init) << '\n';
+    std::cout << "Reducer host/device crossover: " << sum.crossover() << " elements\n";
+
+    /* Both paths stay available regardless of the crossover. */
+    assert(sum.reduce_on_host(v, init) == resStl);
+    assert(sum.reduce_on_device(v, init) == resStl);
+
+    /* Data that already lives on the device is reduced in place, and the
+     * result stays on the device until it is read back. */
+    {
+        cl::sycl::buffer<int, 1> bufV(v.data(), cl::sycl::range<1>(v.size()));
+        cl::sycl::buffer<int, 1> bufSum{ cl::sycl::range<1>(1) };
+        sum.reduce(bufV, bufSum, init);
+        auto hSum = bufSum.get_access<cl::sycl::access::mode::read>();
+        assert(hSum[0] == resStl);
+    }
+
+    {
+        auto& q = sum.get_queue();
+        int* dV = cl::sycl::experimental::malloc_device<int>(v.size(), q);
+        int* dSum = cl::sycl::experimental::malloc_device<int>(1, q);
+
+        auto copied = q.memcpy(dV, v.data(), v.size() * sizeof(int));
+        auto reduced = sum.reduce(dV, v.size(), dSum, init, { copied });
+
+        int resUsm = 0;
+        q.submit([&](cl::sycl::handler& h){
+            h.depends_on(reduced);
+            h.memcpy(&resUsm, dSum, sizeof(int));
+        }).wait();
+        assert(resUsm == resStl);
+
+        cl::sycl::experimental::free(dV, q);
+        cl::sycl::experimental::free(dSum, q);
+    }
+
+    /* Both tails of reduction_v5.hpp, for lengths whose work-groups are not a
+     * multiple of the sub-group size (88 elements make work-groups of 44), so
+     * the last sub-group of a work-group is partial. */
+    {
+        cl::sycl::queue q;
+        for(size_t n : { size_t(88), size_t(90), size_t(138), size_t(1000), size_t(4097) }){
+            std::vector<int> w(v.begin(), v.begin() + std::min(n, v.size()));
+            int expected = std::accumulate(w.begin(), w.end(), init);
+            assert(chiu::sycl_reduce(q, w, init, binaryop, chiu::reduction_tail::unrolled) == expected);
+            if(chiu::has_sub_groups(q.get_device())){
+                assert(chiu::sycl_reduce(q, w, init, binaryop, chiu::reduction_tail::sub_group) == expected);
+            }
+        }
+    }
+
+    /* Floating-point inputs take the vectorized path as well. The values are
+     * small integers, so the sums are exact in any order. */
+    std::vector<double> vd(v.begin(), v.end());
+    double initd = init;
+    auto resDouble = chiu::sycl_reduce(vd, initd, std::plus<double>{});
+    assert(resDouble == static_cast<double>(resStl));
+
+    /* The deterministic and compensated modes give the same exact sums. */
+    assert(chiu::deterministic_reduce(vd, initd, std::plus<double>{}) == resDouble);
+    assert(chiu::compensated_sum(vd, initd) == resDouble);
+
+    /* The transform is applied while the elements are loaded, so f(x) is
+     * never materialized in global memory. */
+    long sumSquares = chiu::transform_reduce(v, 0L, std::plus<long>{}, square{});
+    long sumSquaresStl = std::accumulate(std::begin(v), std::end(v), 0L,
+                                         [](long acc, int x){ return acc + square{}(x); });
+    assert(sumSquares == sumSquaresStl);
+
+    double dot = chiu::transform_reduce(vd, vd, 0.0, std::plus<double>{}, std::multiplies<double>{});
+    assert(dot == static_cast<double>(sumSquaresStl));
+
+    /* A second input shorter than the first is rejected before any buffer
+     * reads past its end. */
+    if(!vd.empty()){
+        std::vector<double> shorter(vd.begin(), vd.end() - 1);
+        bool rejected = false;
+        try{
+            chiu::transform_reduce(vd, shorter, 0.0, std::plus<double>{}, std::multiplies<double>{});
+        } catch (std::invalid_argument&){
+            rejected = true;
+        }
+        assert(rejected);
+    }
+
+    /* Segments of very different lengths, including empty ones, are reduced
+     * together. The last segment takes whatever is left of v. */
+    std::vector<size_t> offsets{ 0 };
+    for(size_t i = 0; offsets.back() < v.size(); i++){
+        size_t segment = (i % 7) * ((i % 3 == 0) ? 100 : 1);
+        offsets.push_back(std::min(offsets.back() + segment, v.size()));
+        if(i == 50)    offsets.back() = v.size();
+    }
+
+    auto segmentSums = chiu::segmented_reduce(v, offsets, binaryop, init);
+    for(size_t s = 0; s + 1 < offsets.size(); s++){
+        assert(segmentSums[s] == std::accumulate(v.begin() + offsets[s], v.begin() + offsets[s + 1], init, binaryop));
+    }
+
+    /* Only empty segments over no values, and only segments too long for a
+     * single work-item, leave some of the work lists empty. */
+    std::vector<int> none;
+    auto emptySums = chiu::segmented_reduce(none, std::vector<size_t>(5, 0), binaryop, init);
+    assert(emptySums == std::vector<int>(4, init));
+
+    std::vector<int> longValues(5 * chiu::segmented_small_segment + 3);
+    std::generate(longValues.begin(), longValues.end(), f);
+    std::vector<size_t> longOffsets{ 0, 2 * chiu::segmented_small_segment, longValues.size() };
+    auto longSums = chiu::segmented_reduce(longValues, longOffsets, binaryop, init);
+    for(size_t s = 0; s + 1 < longOffsets.size(); s++){
+        assert(longSums[s] == std::accumulate(longValues.begin() + longOffsets[s], longValues.begin() + longOffsets[s + 1], init, binaryop));
+    }
+
+    /* Column statistics in a single pass over v. */
+    auto stats = chiu::reduce_many(v, std::make_tuple(std::plus<int>{}, chiu::minimum<int>{}, chiu::maximum<int>{},
+                                                      chiu::count{}, chiu::argmin<int>{}, chiu::argmax<int>{}));
+    auto minIt = std::min_element(v.begin(), v.end());
+    auto maxIt = std::max_element(v.begin(), v.end());
+    assert(std::get<0>(stats) == resStl - init);
+    assert(std::get<1>(stats) == *minIt);
+    assert(std::get<2>(stats) == *maxIt);
+    assert(std::get<3>(stats) == v.size());
+    assert(std::get<4>(stats).value == *minIt && std::get<4>(stats).index == size_t(minIt - v.begin()));
+    assert(std::get<5>(stats).value == *maxIt && std::get<5>(stats).index == size_t(maxIt - v.begin()));
+
     std::cout << "Result is correct!\n";
 
     return 0;
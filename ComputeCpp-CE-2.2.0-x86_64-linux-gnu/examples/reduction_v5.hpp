@@ -26,139 +26,271 @@
  **************************************************************************/
 
 #include <CL/sycl.hpp>
+#include <SYCL/experimental/sub_group.h>
+#include <algorithm>
 #include <iostream>
+#include <type_traits>
 #include <vector>
 
 
 
 namespace chiu{
 
-    template<typename T>
-    class sycl_reduction;
+    /* Dummy class to generate unique kernel names. The binary operator is part
+     * of the name, so it has to be a named function object (e.g. std::plus<T>)
+     * rather than a lambda. SubGroup selects the work-group tail. */
+    template<typename T, typename C, bool SubGroup>
+    class sycl_reduction_v5;
 
 
-    template <typename T, typename I, typename C>
-    T sycl_reduce(const std::vector<T>& v, I& init, C bop){
-        T retVal;
-
-        {
-            cl::sycl::queue q([=](cl::sycl::exception_list eL){
-                try{
-                    for(auto& e : eL)    std::rethrow_exception(e);
-                } catch (cl::sycl::exception ex){
-                    std::cout << " There is an exception in the reduction kernel\n";
-                    std::cout << ex.what() << '\n';
+    /* How each work-group finishes its reduction. The unrolled tail combines
+     * the last 32 values in local memory with a barrier after every step; the
+     * sub-group tail combines values inside a sub-group with shuffles and only
+     * one value per sub-group goes through local memory. automatic picks the
+     * sub-group tail when the device supports it. Types that are not
+     * arithmetic always take the unrolled tail, even if sub_group is asked. */
+    enum class reduction_tail{ automatic, sub_group, unrolled };
+
+
+    /* Returns true if kernels on device can use sub-group functions. The host
+     * device always can, with sub-groups of a single work-item. */
+    inline bool has_sub_groups(const cl::sycl::device& device){
+        return device.is_host() || device.has_extension("cl_khr_subgroups")
+                                || device.has_extension("cl_intel_subgroups");
+    }
+
+
+    /* Returns the smallest power of two that is greater than or equal to x. */
+    inline size_t next_pow2_v5(size_t x){
+        size_t p = 1;
+        while(p < x)    p <<= 1;
+        return p;
+    }
+
+
+    /* Enqueues one reduction pass. Every work-group of `local` work-items
+     * reduces 2 * local consecutive elements of bufIn and writes its result
+     * into bufOut; the last work-group may be partial. */
+    template <bool SubGroup, typename T, typename C>
+    void sycl_reduce_pass_v5(cl::sycl::queue& q, cl::sycl::buffer<T, 1>& bufIn, cl::sycl::buffer<T, 1>& bufOut,
+                             size_t length, size_t groups, size_t local, C bop){
+        static_assert(!SubGroup || std::is_arithmetic<T>::value, "Sub-group shuffles need an arithmetic type.");
+
+        q.submit([&](cl::sycl::handler& h){
+            cl::sycl::nd_range<1> r{ cl::sycl::range<1>{ groups * local }, cl::sycl::range<1>{ local } };
+
+            /* Three accessors are used: one to the buffer that is being reduced,
+             * one to the buffer receiving the partial results and a third to
+             * local memory, used to store intermediate data. The sub-group
+             * tail also shares the width of the first sub-group in local
+             * memory. */
+            auto aI = bufIn.template get_access<cl::sycl::access::mode::read>(h);
+            auto aO = bufOut.template get_access<cl::sycl::access::mode::discard_write>(h);
+            cl::sycl::accessor<T, 1, cl::sycl::access::mode::read_write,
+                                     cl::sycl::access::target::local> scratch(cl::sycl::range<1>(local), h);
+            cl::sycl::accessor<size_t, 1, cl::sycl::access::mode::read_write,
+                                          cl::sycl::access::target::local> sgWidth(cl::sycl::range<1>(1), h);
+
+            size_t half = next_pow2_v5(local) / 2;
+
+            /* The parallel_for invocation chosen is the variant with an nd_item
+             * parameter, since the code requires barriers for correctness. */
+            h.parallel_for<sycl_reduction_v5<T, C, SubGroup>>(r, [aI, aO, scratch, sgWidth, length, local, half, bop](cl::sycl::nd_item<1> id){
+                size_t localid = id.get_local_id(0);
+                size_t group = id.get_group(0);
+
+                /* Number of work-items of this group that own at least one
+                 * element. Only the last work-group can have fewer than local. */
+                size_t begin = group * local * 2;
+                size_t count = std::min(local, (length - begin + 1) / 2);
+
+                /* Every work-item reads two adjacent elements of its group's
+                 * segment, with one vector load when both are in range.
+                 * cl::sycl::vec only holds arithmetic types, so other types
+                 * read two scalars. */
+                size_t pair = group * local + localid;
+                T x{};
+                if(localid < count){
+                    if(2 * pair + 1 < length){
+                        if constexpr(std::is_arithmetic<T>::value){
+                            cl::sycl::vec<T, 2> v;
+                            v.load(pair, aI);
+                            x = bop(v.x(), v.y());
+                        }
+                        else    x = bop(aI[2 * pair], aI[2 * pair + 1]);
+                    }
+                    else    x = aI[2 * pair];
+                }
+
+                if constexpr(SubGroup){
+                    /* Each sub-group folds its values with shuffles, which need
+                     * no barrier. The lanes are only combined with lanes that
+                     * hold a value. */
+                    auto sg = id.get_sub_group();
+                    size_t sgRange = sg.get_local_range()[0];
+
+                    /* On a device the last sub-group of a work-group is smaller
+                     * when local is not a multiple of the sub-group size, so
+                     * the positions come from the sub-group itself. The host
+                     * device runs every work-item as a sub-group of its own,
+                     * but reports its local id as the sub-group local id. */
+#ifdef __SYCL_DEVICE_ONLY__
+                    size_t sgLocal = sg.get_local_id()[0];
+                    size_t sgId = sg.get_group_id()[0];
+#else
+                    size_t sgLocal = 0;
+                    size_t sgId = localid;
+#endif
+
+                    for(size_t delta = next_pow2_v5(sgRange) / 2; delta > 0; delta /= 2){
+                        T y = sg.shuffle_down(x, static_cast<uint32_t>(delta));
+                        if(sgLocal + delta < sgRange && localid + delta < count)    x = bop(x, y);
+                    }
+
+                    /* The first lane of every sub-group writes its result into
+                     * local memory, and these few values are combined in a tree.
+                     * The first sub-group has the full width, and every
+                     * work-item derives the number of values from it, so all of
+                     * them reach the same barriers. */
+                    if(sgLocal == 0 && localid < count)    scratch[sgId] = x;
+                    if(localid == 0)    sgWidth[0] = sgRange;
+                    id.barrier(cl::sycl::access::fence_space::local_space);
+
+                    size_t partials = (count + sgWidth[0] - 1) / sgWidth[0];
+
+                    for(size_t offset = next_pow2_v5(partials) / 2; offset > 0; offset /= 2){
+                        if(localid < offset && localid + offset < partials)    scratch[localid] = bop(scratch[localid], scratch[localid + offset]);
+                        id.barrier(cl::sycl::access::fence_space::local_space);
+                    }
+                }
+                else{
+                    /* All work-items write their values into local memory. The
+                     * barrier ensures all writes are visible to the work-group
+                     * before the tree reduction starts. */
+                    scratch[localid] = x;
+                    id.barrier(cl::sycl::access::fence_space::local_space);
+
+                    /* Apply the reduction operation between the current local
+                     * id and the one on the other half of the range. Every
+                     * work-item reaches each barrier, including the ones that
+                     * have nothing left to combine. */
+                    for(size_t offset = half; offset > 32; offset /= 2){
+                        if(localid < offset && localid + offset < count)    scratch[localid] = bop(scratch[localid], scratch[localid + offset]);
+                        id.barrier(cl::sycl::access::fence_space::local_space);
+                    }
+
+                    if(localid + 32 < count && localid < 32)    scratch[localid] = bop(scratch[localid], scratch[localid + 32]);
+                    id.barrier(cl::sycl::access::fence_space::local_space);
+
+                    if(localid + 16 < count && localid < 16)    scratch[localid] = bop(scratch[localid], scratch[localid + 16]);
+                    id.barrier(cl::sycl::access::fence_space::local_space);
+
+                    if(localid +  8 < count && localid <  8)    scratch[localid] = bop(scratch[localid], scratch[localid + 8]);
+                    id.barrier(cl::sycl::access::fence_space::local_space);
+
+                    if(localid +  4 < count && localid <  4)    scratch[localid] = bop(scratch[localid], scratch[localid + 4]);
+                    id.barrier(cl::sycl::access::fence_space::local_space);
+
+                    if(localid +  2 < count && localid <  2)    scratch[localid] = bop(scratch[localid], scratch[localid + 2]);
+                    id.barrier(cl::sycl::access::fence_space::local_space);
+
+                    if(localid +  1 < count && localid <  1)    scratch[localid] = bop(scratch[localid], scratch[localid + 1]);
+                    id.barrier(cl::sycl::access::fence_space::local_space);
                 }
+
+                /* The final result will be stored in local id 0. */
+                if(localid == 0)    aO[group] = scratch[0];
             });
+        });
+    }
+
+
+    /* Reduces v on q and folds the result into init. Each pass reduces every
+     * 2 * local elements to one, and the passes alternate between two scratch
+     * buffers until a single value is left. */
+    template <typename T, typename I, typename C>
+    T sycl_reduce(cl::sycl::queue& q, const std::vector<T>& v, I& init, C bop,
+                  reduction_tail tail = reduction_tail::automatic){
+        size_t length = v.size();
+
+        if(length == 0)    return init;
+        if(length == 1)    return bop(init, v[0]);
+
+        auto device = q.get_device();
+
+        /* Sub-group shuffles are only defined for the built-in scalar types,
+         * so other types always take the unrolled tail. */
+        bool subGroup = (tail == reduction_tail::sub_group);
+        if(tail == reduction_tail::automatic)    subGroup = has_sub_groups(device);
 
-            /* Output device and platform information. */
-            auto device = q.get_device();
-        
-            auto deviceName = device.get_info<cl::sycl::info::device::name>();
-            std::cout << "Device Name: " << deviceName << '\n';
-        
-            auto platformName = device.get_platform().get_info<cl::sycl::info::platform::name>();
-            std::cout << "Platform Name " << platformName << '\n';
-
-            /* The buffer is used to initialise the data on the device, but we don't
-             * want to copy back and trash it. buffer::set_final_data() tells the
-             * SYCL runtime where to put the data when the buffer is destroyed; nullptr
-             * indicates not to copy back. The vector's length is used as the global
-             * work size (unless that is too large). */
-            cl::sycl::buffer<int, 1> bufI(v.data(), cl::sycl::range<1>(v.size()));
-            bufI.set_final_data(nullptr);
-        
-            size_t local = std::min(v.size(), device.get_info<cl::sycl::info::device::max_work_group_size>());
-            size_t length = v.size();
-
-            if(length == 0)    return init;
-            if(length == 1)    return bop(init, v[0]);
-
-            {
-                /* Each iteration of the do loop applies one level of reduction until
-                 * the input is of length 1 (i.e. the reduction is complete). */
-                do{
-                    auto f = [length, local, &bufI, bop](cl::sycl::handler& h) mutable{
-                        cl::sycl::nd_range<1> r{ cl::sycl::range<1>{ std::max(length, local) }, cl::sycl::range<1>{ std::min(length, local) } };
-
-                        /* Two accessors are used: one to the buffer that is being reduced,
-                         * and a second to local memory, used to store intermediate data. */
-                        auto aI = bufI.get_access<cl::sycl::access::mode::read_write>(h);
-                        cl::sycl::accessor<T, 1, cl::sycl::access::mode::read_write, 
-                                                 cl::sycl::access::target::local> scratch(cl::sycl::range<1>(local), h);
-
-                        /* The parallel_for invocation chosen is the variant with an nd_item
-                         * parameter, since the code requires barriers for correctness. */
-                        h.parallel_for<sycl_reduction<T>>(r, [aI, scratch, local, length, bop](cl::sycl::nd_item<1> id){
-                            //size_t globalid = id.get_global_id(0);
-                            size_t localid = id.get_local_id(0);
-                     
-                            size_t iid = id.get_local_id(0) + id.get_group(0) * (id.get_local_range(0) * 2);
-                            /* All threads collectively read from global memory into local.
-                             * The barrier ensures all threads' IO is resolved before
-                             * execution continues (strictly speaking, all threads within
-                             * a single work-group - there is no co-ordination between
-                             * work-groups, only work-items). */
-                            if(iid < length){
-                                if(id.get_group_range(0) > 1){
-                                    if(iid + id.get_local_range(0) < length)    scratch[localid] = bop(aI[iid], aI[iid + id.get_local_range(0)]);
-                                    else                                        scratch[localid] = aI[iid];
-                                }
-                                else    scratch[localid] = aI[iid];
-                            }
-                            id.barrier(cl::sycl::access::fence_space::local_space);
-
-                            /* Apply the reduction operation between the current local
-                             * id and the one on the other half of the vector. */
-                            for(size_t offset = id.get_local_range(0) / 2; offset > 32; offset /= 2){
-                                if(localid < offset)    scratch[localid] = bop(scratch[localid], scratch[localid + offset]);
-                                id.barrier(cl::sycl::access::fence_space::local_space);
-                            }
-                 
-                            if(localid < 32){
-                                if((length > 32) && (localid + 32 < length))    scratch[localid] = bop(scratch[localid], scratch[localid + 32]);
-                                id.barrier(cl::sycl::access::fence_space::local_space);
-                                
-                                if((length > 16) && (localid + 16 < length))    scratch[localid] = bop(scratch[localid], scratch[localid + 16]);
-                                id.barrier(cl::sycl::access::fence_space::local_space);
-
-                                if((length >  8) && (localid + 8  < length))    scratch[localid] = bop(scratch[localid], scratch[localid + 8]);
-                                id.barrier(cl::sycl::access::fence_space::local_space);
-                                
-                                if((length >  4) && (localid + 4  < length))    scratch[localid] = bop(scratch[localid], scratch[localid + 4]);
-                                id.barrier(cl::sycl::access::fence_space::local_space);
-
-                                if((length >  2) && (localid + 2  < length))    scratch[localid] = bop(scratch[localid], scratch[localid + 2]);
-                                id.barrier(cl::sycl::access::fence_space::local_space);
-
-                                if((length >  1) && (localid + 1  < length))    scratch[localid] = bop(scratch[localid], scratch[localid + 1]);
-                                id.barrier(cl::sycl::access::fence_space::local_space);
-                            }
-                            /* The final result will be stored in local id 0. */
-                            if(localid == 0)    aI[id.get_group(0)] = scratch[localid];
-                        });
-                    };
-
-                    q.submit(f);
-
-                    /* At this point, you could queue::wait_and_throw() to ensure that
-                     * errors are caught quickly. However, this would likely impact
-                     * performance negatively. */                
-                    length = length / local;
-                    length = length / 2;
-
-                } while(length > 1);
+        size_t maxLocal = device.get_info<cl::sycl::info::device::max_work_group_size>();
+        auto groups_of = [maxLocal](size_t n){
+            size_t local = std::min(maxLocal, (n + 1) / 2);
+            return std::make_pair((n + 2 * local - 1) / (2 * local), local);
+        };
+
+        /* The buffer is used to initialise the data on the device, but we don't
+         * want to copy back and trash it. buffer::set_final_data() tells the
+         * SYCL runtime where to put the data when the buffer is destroyed; nullptr
+         * indicates not to copy back. */
+        cl::sycl::buffer<T, 1> bufI(v.data(), cl::sycl::range<1>(length));
+        bufI.set_final_data(nullptr);
+
+        size_t firstGroups = groups_of(length).first;
+        cl::sycl::buffer<T, 1> bufA{ cl::sycl::range<1>(firstGroups) };
+        cl::sycl::buffer<T, 1> bufB{ cl::sycl::range<1>(std::max<size_t>(1, groups_of(firstGroups).first)) };
+
+        cl::sycl::buffer<T, 1>* in = &bufI;
+        cl::sycl::buffer<T, 1>* out = &bufA;
+
+        /* Each iteration of the do loop applies one level of reduction until
+         * the input is of length 1 (i.e. the reduction is complete). */
+        do{
+            auto launch = groups_of(length);
+            /* The sub-group pass is only instantiated for types it can
+             * shuffle. */
+            if constexpr(std::is_arithmetic<T>::value){
+                if(subGroup)    sycl_reduce_pass_v5<true>(q, *in, *out, length, launch.first, launch.second, bop);
+                else            sycl_reduce_pass_v5<false>(q, *in, *out, length, launch.first, launch.second, bop);
             }
+            else    sycl_reduce_pass_v5<false>(q, *in, *out, length, launch.first, launch.second, bop);
+
+            /* At this point, you could queue::wait_and_throw() to ensure that
+             * errors are caught quickly. However, this would likely impact
+             * performance negatively. */
+            length = launch.first;
+            in = out;
+            out = (out == &bufA) ? &bufB : &bufA;
+        } while(length > 1);
+
+        /* It is always sensible to wrap host accessors in their own scope as
+         * kernels using the buffers they access are blocked for the length
+         * of the accessor's lifetime. */
+        auto hI = in->template get_access<cl::sycl::access::mode::read>();
+        return bop(init, hI[0]);
+    }
 
-            {
-                /* It is always sensible to wrap host accessors in their own scope as
-                 * kernels using the buffers they access are blocked for the length
-                 * of the accessor's lifetime. */
-                auto hI = bufI.template get_access<cl::sycl::access::mode::read>();
-                retVal = bop(init, hI[0]);
+
+    template <typename T, typename I, typename C>
+    T sycl_reduce(const std::vector<T>& v, I& init, C bop){
+        cl::sycl::queue q([=](cl::sycl::exception_list eL){
+            try{
+                for(auto& e : eL)    std::rethrow_exception(e);
+            } catch (cl::sycl::exception ex){
+                std::cout << " There is an exception in the reduction kernel\n";
+                std::cout << ex.what() << '\n';
             }
-        }
+        });
+
+        /* Output device and platform information. */
+        auto device = q.get_device();
+
+        auto deviceName = device.get_info<cl::sycl::info::device::name>();
+        std::cout << "Device Name: " << deviceName << '\n';
+
+        auto platformName = device.get_platform().get_info<cl::sycl::info::platform::name>();
+        std::cout << "Platform Name " << platformName << '\n';
 
-        return retVal;
+        return sycl_reduce(q, v, init, bop);
     }
 }
@@ -8,11 +8,11 @@ read -p 'Filename: ' filename
 
 
 # Building CXX object samples .o file
-g++ -isystem ../include -Wall -std=c++17 -include $filename.sycl -x c++ -o $filename.o -c $filename.cpp
+g++ -isystem ../include -Wall -pthread -std=c++17 -include $filename.sycl -x c++ -o $filename.o -c $filename.cpp
 
 
 # Linking CXX executable 
-g++ -Wall $filename.o  -o $filename -Wl,-rpath,../lib: ../lib/libComputeCpp.so
+g++ -Wall -pthread $filename.o  -o $filename -Wl,-rpath,../lib: ../lib/libComputeCpp.so
 
 
 # Delete .o and .s and .sycl
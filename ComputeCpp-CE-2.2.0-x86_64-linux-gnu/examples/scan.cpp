@@ -21,234 +21,25 @@
  *  scan.cpp
  *
  *  Description:
- *    Example of a parallel inclusive scan in SYCL.
+ *    Example of parallel inclusive and exclusive scans in SYCL.
  *
  **************************************************************************/
 
-#include <CL/sycl.hpp>
-namespace sycl = cl::sycl;
-
 #include <algorithm>
 #include <iostream>
+#include <iterator>
 #include <numeric>
 #include <vector>
 
-// The identity element for a given operation.
-template <typename T, typename Op>
-struct identity {};
-
-template <typename T>
-struct identity<T, std::plus<T>> {
-  static constexpr T value = 0;
-};
-
-template <typename T>
-struct identity<T, std::multiplies<T>> {
-  static constexpr T value = 1;
-};
-
-template <typename T>
-struct identity<T, std::logical_or<T>> {
-  static constexpr T value = false;
-};
-
-template <typename T>
-struct identity<T, std::logical_and<T>> {
-  static constexpr T value = true;
-};
-
-// Dummy struct to generate unique kernel name types
-template <typename T, typename U, typename V>
-struct kernel_name {};
-
-/* Performs an inclusive scan with the given associative binary operation `Op`
- * on the data in the `in` buffer. Runs in parallel on the provided accelerated
- * hardware queue. Modifies the input buffer to contain the results of the scan.
- * Input size has to be a power of two. If the size isn't so, the input can
- * easily be padded to the nearest power of two with any values, and the scan on
- * the meaningful part of the data will stay the same. */
-template <typename T, typename Op>
-void par_scan(sycl::buffer<T, 1>& in, sycl::queue& q) {
-  if ((in.get_count() & (in.get_count() - 1)) != 0 || in.get_count() == 0) {
-    throw std::runtime_error("Given input size is not a power of two.");
-  }
-
-  // Retrieve the device associated with the given queue.
-  auto dev = q.get_device();
-
-  // Check if there is enough global memory.
-  size_t global_mem_size = dev.get_info<sycl::info::device::global_mem_size>();
-  if (!dev.is_host() && in.get_count() > (global_mem_size / 2)) {
-    throw std::runtime_error("Input size exceeds device global memory size.");
-  }
-
-  /* Check if local memory is available. On host no local memory is fine, since
-   * it is emulated. */
-  if (!dev.is_host() && dev.get_info<sycl::info::device::local_mem_type>() ==
-                            sycl::info::local_mem_type::none) {
-    throw std::runtime_error("Device does not have local memory.");
-  }
-
-  // Obtain device limits.
-  size_t max_wgroup_size =
-      dev.get_info<sycl::info::device::max_work_group_size>();
-  size_t local_mem_size = dev.get_info<sycl::info::device::local_mem_size>();
-
-  /* Find a work-group size that is guaranteed to fit in local memory and is
-   * below the maximum work-group size of the device. */
-  size_t wgroup_size_lim =
-      sycl::min(max_wgroup_size, local_mem_size / (2 * sizeof(T)));
-
-  /* Every work-item processes two elements, so the work-group size has to
-   * divide this number evenly. */
-  size_t half_in_size = in.get_count() / 2;
-
-  size_t wgroup_size = 0;
-  /* Find the largest power of two that divides half_in_size and is within the
-   * device limit. */
-  for (size_t pow = size_t(1) << (sizeof(size_t) * 8 - 1); pow > 0; pow >>= 1) {
-    if ((half_in_size / pow) * pow == half_in_size && pow <= wgroup_size_lim) {
-      wgroup_size = pow;
-      break;
-    }
-  }
-
-  if (wgroup_size == 0) {
-    throw std::runtime_error(
-        "Could not find an appropriate work-group size for the given input.");
-  }
-
-  q.submit([&](sycl::handler& cgh) {
-    auto data = in.template get_access<sycl::access::mode::read_write>(cgh);
-    sycl::accessor<T, 1, sycl::access::mode::read_write,
-                   sycl::access::target::local>
-
-        temp(wgroup_size * 2, cgh);
-
-    // Use dummy struct as the unique kernel name.
-    cgh.parallel_for<kernel_name<T, Op, class scan_segments>>(
-        sycl::nd_range<1>(half_in_size, wgroup_size),
-        [=](sycl::nd_item<1> item) {
-          /* Two-phase exclusive scan algorithm due to Guy E. Blelloch in
-           * "Prefix Sums and Their Applications", 1990. */
-
-          size_t gid = item.get_global_linear_id();
-          size_t lid = item.get_local_linear_id();
-
-          // Read data into local memory.
-          temp[2 * lid] = data[2 * gid];
-          temp[2 * lid + 1] = data[2 * gid + 1];
-
-          // Preserve the second input element to add at the end.
-          auto second_in = temp[2 * lid + 1];
-
-          /* Perform partial reduction (up-sweep) on the data. The `off`
-           * variable is 2 to the power of the current depth of the
-           * reduction tree. In the paper, this corresponds to 2^d. */
-          for (size_t off = 1; off < (wgroup_size * 2); off *= 2) {
-            // Synchronize local memory to observe the previous writes.
-            item.barrier(sycl::access::fence_space::local_space);
-
-            size_t i = lid * off * 2;
-            if (i < wgroup_size * 2) {
-              temp[i + off * 2 - 1] =
-                  Op{}(temp[i + off * 2 - 1], temp[i + off - 1]);
-            }
-          }
-
-          // Clear the last element to the identity before down-sweeping.
-          if (lid == 0) {
-            temp[wgroup_size * 2 - 1] = identity<T, Op>::value;
-          }
-
-          /* Perform down-sweep on the tree to compute the whole scan.
-           * Again, `off` is 2^d. */
-          for (size_t off = wgroup_size; off > 0; off >>= 1) {
-            item.barrier(sycl::access::fence_space::local_space);
-
-            size_t i = lid * off * 2;
-            if (i < wgroup_size * 2) {
-              auto t = temp[i + off - 1];
-              auto u = temp[i + off * 2 - 1];
-              temp[i + off - 1] = u;
-              temp[i + off * 2 - 1] = Op{}(t, u);
-            }
-          }
-
-          // Synchronize again to observe results.
-          item.barrier(sycl::access::fence_space::local_space);
-
-          /* To return an inclusive rather than exclusive scan result, shift
-           * each element left by 1 when writing back into global memory. If
-           * we are the last work-item, also add on the final element. */
-          data[2 * gid] = temp[2 * lid + 1];
-
-          if (lid == wgroup_size - 1) {
-            data[2 * gid + 1] = Op{}(temp[2 * lid + 1], second_in);
-          } else {
-            data[2 * gid + 1] = temp[2 * lid + 2];
-          }
-        });
-  });
-
-  // At this point we have computed the inclusive scans of this many segments.
-  size_t n_segments = half_in_size / wgroup_size;
-
-  if (n_segments == 1) {
-    // If all of the data is in one segment, we're done.
-    return;
-  }
-  // Otherwise we have to propagate the scan results forward into later
-  // segments.
-
-  // Allocate space for one (last) element per segment.
-  sycl::buffer<T, 1> ends{sycl::range<1>(n_segments)};
-
-  // Store the elements in this space.
-  q.submit([&](sycl::handler& cgh) {
-    auto scans = in.template get_access<sycl::access::mode::read>(cgh);
-    auto elems =
-        ends.template get_access<sycl::access::mode::discard_write>(cgh);
-
-    cgh.parallel_for<kernel_name<T, Op, class copy_ends>>(
-        sycl::range<1>(n_segments), [=](sycl::item<1> item) {
-          auto id = item.get_linear_id();
-          // Offset into the last element of each segment.
-          elems[item] = scans[(id + 1) * 2 * wgroup_size - 1];
-        });
-  });
-
-  // Recursively scan the array of last elements.
-  par_scan<T, Op>(ends, q);
-
-  // Add the results of the scan to each segment.
-  q.submit([&](sycl::handler& cgh) {
-    auto ends_scan = ends.template get_access<sycl::access::mode::read>(cgh);
-    auto data = in.template get_access<sycl::access::mode::read_write>(cgh);
-
-    cgh.parallel_for<kernel_name<T, Op, class add_ends>>(
-        // Work with one less work-group, since the first segment is correct.
-        sycl::nd_range<1>(half_in_size - wgroup_size, wgroup_size),
-        [=](sycl::nd_item<1> item) {
-          auto group = item.get_group_linear_id();
-
-          // Start with the second segment.
-          auto off_gid = item.get_global_linear_id() + wgroup_size;
-
-          /* Each work-group adds the corresponding number in the
-           * "last element scan" array to every element in the group's
-           * segment. */
-          data[off_gid * 2] = Op{}(data[off_gid * 2], ends_scan[group]);
-          data[off_gid * 2 + 1] = Op{}(data[off_gid * 2 + 1], ends_scan[group]);
-        });
-  });
-}
+#include "scan.hpp"
 
 /* Tests the scan with an addition operation, which is its most common use.
- * Returns 0 if successful, a nonzero value otherwise. */
-int test_sum(sycl::queue& q) {
-  constexpr size_t size = 512;
-
+ * `K` is the number of elements per work-item of the blocked scan, and the
+ * scan uses the storage of `workspace` if given. Returns 0 if successful, a
+ * nonzero value otherwise. */
+template <size_t K = scan_items_per_work_item<int32_t>::value>
+int test_sum(sycl::queue& q, size_t size, scan_algorithm algorithm,
+             scan_workspace<int32_t>* workspace = nullptr) {
   // Initializes a vector of sequentially increasing values.
   std::vector<int32_t> in(size);
   std::iota(in.begin(), in.end(), 1);
@@ -264,7 +55,8 @@ int test_sum(sycl::queue& q) {
       cgh.copy(in.data(), acc);
     });
 
-    par_scan<int32_t, std::plus<int32_t>>(buf, q);
+    par_scan<int32_t, std::plus<int32_t>, K>(
+        buf, buf, q, 0, scan_type::inclusive, algorithm, workspace);
   }
 
   // Compute the same operation using the standard library.
@@ -336,14 +128,430 @@ int test_factorial(sycl::queue& q) {
   return 0;
 }
 
+/* Compares a scan result with the expected values and prints both on a
+ * mismatch. Returns 0 if they are equal, a nonzero value otherwise. */
+int check(const char* name, const std::vector<int32_t>& result,
+          const std::vector<int32_t>& expected) {
+  if (result == expected) {
+    return 0;
+  }
+  std::cout << "SYCL " << name << " computation incorrect! CPU Results:\n";
+  for (auto a : expected) {
+    std::cout << a << " ";
+  }
+  std::cout << "\nSYCL results:\n";
+  for (auto a : result) {
+    std::cout << a << " ";
+  }
+  std::cout << std::endl;
+  return 1;
+}
+
+/* Tests out-of-place running-minimum and running-maximum scans, inclusive and
+ * exclusive, and an in-place exclusive scan with a user-supplied identity.
+ * Returns 0 if successful, a nonzero value otherwise. */
+int test_extrema(sycl::queue& q, scan_algorithm algorithm) {
+  constexpr size_t size = 3001;
+
+  // Values that go up and down, so the extrema change along the input.
+  std::vector<int32_t> in(size);
+  for (size_t i = 0; i < size; i++) {
+    in[i] = static_cast<int32_t>((i * 7919) % 1000) - 500;
+  }
+
+  std::vector<int32_t> scanned(in);
+  std::vector<int32_t> running_max(size);
+  std::vector<int32_t> before_min(size);
+  std::vector<int32_t> before_xor(size);
+  {
+    // Any change to the input is written back to `scanned`.
+    sycl::buffer<int32_t, 1> in_buf(scanned.data(), sycl::range<1>(size));
+    sycl::buffer<int32_t, 1> max_buf{sycl::range<1>(size)};
+    max_buf.set_final_data(running_max.data());
+    sycl::buffer<int32_t, 1> min_buf{sycl::range<1>(size)};
+    min_buf.set_final_data(before_min.data());
+    sycl::buffer<int32_t, 1> xor_buf(in.data(), sycl::range<1>(size));
+    xor_buf.set_final_data(before_xor.data());
+
+    par_scan<int32_t, maximum<int32_t>>(in_buf, max_buf, q, algorithm);
+    par_exclusive_scan<int32_t, minimum<int32_t>>(in_buf, min_buf, q,
+                                                  algorithm);
+    par_scan<int32_t, std::bit_xor<int32_t>>(xor_buf, xor_buf, q, 0,
+                                             scan_type::exclusive, algorithm);
+  }
+
+  // Compute the same operations using the standard library.
+  std::vector<int32_t> test_max(size);
+  std::inclusive_scan(in.begin(), in.end(), test_max.begin(),
+                      maximum<int32_t>{});
+  std::vector<int32_t> test_min(size);
+  std::exclusive_scan(in.begin(), in.end(), test_min.begin(),
+                      std::numeric_limits<int32_t>::max(), minimum<int32_t>{});
+  std::vector<int32_t> test_xor(size);
+  std::exclusive_scan(in.begin(), in.end(), test_xor.begin(), 0,
+                      std::bit_xor<int32_t>{});
+
+  // An out-of-place scan leaves its input alone.
+  auto ret = check("out-of-place input", scanned, in);
+  if (ret == 0) {
+    ret = check("running maximum", running_max, test_max);
+  }
+  if (ret == 0) {
+    ret = check("exclusive running minimum", before_min, test_min);
+  }
+  if (ret == 0) {
+    ret = check("exclusive xor", before_xor, test_xor);
+  }
+  return ret;
+}
+
+/* Tests inclusive and exclusive segmented sums, with segments given by head
+ * flags and by offsets. Returns 0 if successful, a nonzero value otherwise. */
+int test_segmented(sycl::queue& q, scan_algorithm algorithm) {
+  constexpr size_t size = 5001;
+
+  /* Segments of irregular lengths, including single elements, that start
+   * anywhere within a work-group. Offsets repeat for empty segments. */
+  std::vector<size_t> offsets = {0, 0};
+  while (offsets.back() < size) {
+    size_t length = (offsets.size() * 37) % 211 + 1;
+    if (offsets.size() % 5 == 0) {
+      offsets.push_back(offsets.back());
+    }
+    offsets.push_back(std::min(offsets.back() + length, size));
+  }
+
+  std::vector<int32_t> in(size);
+  std::iota(in.begin(), in.end(), 1);
+  std::vector<int> heads(size, 0);
+  for (size_t i = 0; i + 1 < offsets.size(); i++) {
+    if (offsets[i] < size) {
+      heads[offsets[i]] = 1;
+    }
+  }
+
+  // Compute the same operations using the standard library.
+  std::vector<int32_t> test_inclusive(size);
+  std::vector<int32_t> test_exclusive(size);
+  for (size_t i = 0; i + 1 < offsets.size(); i++) {
+    auto first = in.begin() + offsets[i];
+    auto last = in.begin() + offsets[i + 1];
+    std::inclusive_scan(first, last, test_inclusive.begin() + offsets[i]);
+    std::exclusive_scan(first, last, test_exclusive.begin() + offsets[i], 0);
+  }
+
+  std::vector<int32_t> inclusive(size);
+  std::vector<int32_t> exclusive(size);
+  {
+    sycl::buffer<int32_t, 1> in_buf(in.data(), sycl::range<1>(size));
+    sycl::buffer<int, 1> heads_buf(heads.data(), sycl::range<1>(size));
+    sycl::buffer<size_t, 1> offsets_buf(offsets.data(),
+                                        sycl::range<1>(offsets.size()));
+    sycl::buffer<int32_t, 1> inclusive_buf(inclusive.data(),
+                                           sycl::range<1>(size));
+    sycl::buffer<int32_t, 1> exclusive_buf(exclusive.data(),
+                                           sycl::range<1>(size));
+
+    par_segmented_scan<int32_t, std::plus<int32_t>>(
+        in_buf, heads_buf, inclusive_buf, q, scan_type::inclusive, algorithm);
+    par_segmented_scan_offsets<int32_t, std::plus<int32_t>>(
+        in_buf, offsets_buf, exclusive_buf, q, scan_type::exclusive,
+        algorithm);
+  }
+
+  auto ret = check("segmented inclusive sum", inclusive, test_inclusive);
+  if (ret == 0) {
+    ret = check("segmented exclusive sum", exclusive, test_exclusive);
+  }
+  return ret;
+}
+
+// Selects multiples of three. Predicates name kernels, so this is no lambda.
+struct multiple_of_three {
+  bool operator()(int32_t x) const { return x % 3 == 0; }
+};
+
+// A second predicate on the same type, whose kernels need their own names.
+struct below_half {
+  bool operator()(int32_t x) const { return x < 500; }
+};
+
+/* Tests copy_if, remove_if and stable partition on buffers, and copy_if and
+ * partition on USM device memory, enqueued back to back before waiting. All
+ * of them share one workspace. A second predicate on the same element type
+ * runs copy_if and partition as well. Returns 0 if successful, a nonzero value
+ * otherwise. */
+int test_compaction(sycl::queue& q) {
+  constexpr size_t size = 5001;
+
+  std::vector<int32_t> in(size);
+  for (size_t i = 0; i < size; i++) {
+    in[i] = static_cast<int32_t>((i * 7919) % 1000);
+  }
+
+  // Compute the same operations using the standard library.
+  std::vector<int32_t> test_copy;
+  std::copy_if(in.begin(), in.end(), std::back_inserter(test_copy),
+               multiple_of_three{});
+  std::vector<int32_t> test_remove;
+  std::remove_copy_if(in.begin(), in.end(), std::back_inserter(test_remove),
+                      multiple_of_three{});
+  std::vector<int32_t> test_partition(in);
+  std::stable_partition(test_partition.begin(), test_partition.end(),
+                        multiple_of_three{});
+  std::vector<int32_t> test_copy_low;
+  std::copy_if(in.begin(), in.end(), std::back_inserter(test_copy_low),
+               below_half{});
+  std::vector<int32_t> test_partition_low(in);
+  std::stable_partition(test_partition_low.begin(), test_partition_low.end(),
+                        below_half{});
+
+  std::vector<int32_t> copied(size);
+  std::vector<int32_t> removed(size);
+  std::vector<int32_t> partitioned(size);
+  std::vector<int32_t> copied_low(size);
+  std::vector<int32_t> partitioned_low(size);
+  size_t counts[5] = {0, 0, 0, 0, 0};
+  scan_workspace<size_t> workspace(q, size);
+  {
+    sycl::buffer<int32_t, 1> in_buf(in.data(), sycl::range<1>(size));
+    sycl::buffer<int32_t, 1> copy_buf(copied.data(), sycl::range<1>(size));
+    sycl::buffer<int32_t, 1> remove_buf(removed.data(), sycl::range<1>(size));
+    sycl::buffer<int32_t, 1> partition_buf(partitioned.data(),
+                                           sycl::range<1>(size));
+    sycl::buffer<size_t, 1> copy_count(&counts[0], sycl::range<1>(1));
+    sycl::buffer<size_t, 1> remove_count(&counts[1], sycl::range<1>(1));
+    sycl::buffer<size_t, 1> partition_count(&counts[2], sycl::range<1>(1));
+    sycl::buffer<int32_t, 1> copy_low_buf(copied_low.data(),
+                                          sycl::range<1>(size));
+    sycl::buffer<int32_t, 1> partition_low_buf(partitioned_low.data(),
+                                               sycl::range<1>(size));
+    sycl::buffer<size_t, 1> copy_low_count(&counts[3], sycl::range<1>(1));
+    sycl::buffer<size_t, 1> partition_low_count(&counts[4],
+                                                sycl::range<1>(1));
+
+    par_copy_if(q, in_buf, copy_buf, copy_count, multiple_of_three{},
+                workspace);
+    par_remove_if(q, in_buf, remove_buf, remove_count, multiple_of_three{},
+                  workspace);
+    par_partition(q, in_buf, partition_buf, partition_count,
+                  multiple_of_three{}, workspace);
+    par_copy_if(q, in_buf, copy_low_buf, copy_low_count, below_half{},
+                workspace);
+    par_partition(q, in_buf, partition_low_buf, partition_low_count,
+                  below_half{}, workspace);
+  }
+  copied.resize(counts[0]);
+  removed.resize(counts[1]);
+  copied_low.resize(counts[3]);
+
+  /* copy_if and partition on USM device memory, waiting only on events. The
+   * calls return before their kernels finish. */
+  std::vector<int32_t> usm_copied(size);
+  std::vector<int32_t> usm_partitioned(size);
+  size_t usm_counts[2] = {0, 0};
+  int32_t* d_in = sycl::experimental::malloc_device<int32_t>(size, q);
+  int32_t* d_copied = sycl::experimental::malloc_device<int32_t>(size, q);
+  int32_t* d_out = sycl::experimental::malloc_device<int32_t>(size, q);
+  size_t* d_counts = sycl::experimental::malloc_device<size_t>(2, q);
+
+  auto uploaded = q.memcpy(d_in, in.data(), size * sizeof(int32_t));
+  auto copy_done = par_copy_if(q, d_in, size, d_copied, &d_counts[0],
+                               multiple_of_three{}, workspace, {uploaded});
+  auto done = par_partition(q, d_in, size, d_out, &d_counts[1],
+                            multiple_of_three{}, workspace, {uploaded});
+  q.submit([&](sycl::handler& cgh) {
+    cgh.depends_on(copy_done);
+    cgh.memcpy(usm_copied.data(), d_copied, size * sizeof(int32_t));
+  });
+  q.submit([&](sycl::handler& cgh) {
+    cgh.depends_on(done);
+    cgh.memcpy(usm_partitioned.data(), d_out, size * sizeof(int32_t));
+  });
+  q.submit([&](sycl::handler& cgh) {
+    cgh.depends_on({copy_done, done});
+    cgh.memcpy(usm_counts, d_counts, 2 * sizeof(size_t));
+  });
+  q.wait();
+
+  sycl::experimental::free(d_in, q);
+  sycl::experimental::free(d_copied, q);
+  sycl::experimental::free(d_out, q);
+  sycl::experimental::free(d_counts, q);
+  usm_copied.resize(usm_counts[0]);
+
+  auto ret = check("copy_if", copied, test_copy);
+  if (ret == 0) {
+    ret = check("remove_if", removed, test_remove);
+  }
+  if (ret == 0) {
+    ret = check("partition", partitioned, test_partition);
+  }
+  if (ret == 0) {
+    ret = check("copy_if below 500", copied_low, test_copy_low);
+  }
+  if (ret == 0) {
+    ret = check("partition below 500", partitioned_low, test_partition_low);
+  }
+  if (ret == 0) {
+    ret = check("USM copy_if", usm_copied, test_copy);
+  }
+  if (ret == 0) {
+    ret = check("USM partition", usm_partitioned, test_partition);
+  }
+  if (ret == 0 && (counts[2] != test_copy.size() ||
+                   usm_counts[1] != test_copy.size() ||
+                   counts[4] != test_copy_low.size())) {
+    std::cout << "SYCL partition count incorrect!" << std::endl;
+    ret = 1;
+  }
+  return ret;
+}
+
+/* Tests streaming inclusive and exclusive sums in chunks that do not divide
+ * the input. Returns 0 if successful, a nonzero value otherwise. */
+int test_streaming(sycl::queue& q) {
+  constexpr size_t size = 10007;
+  constexpr size_t chunk_size = 3000;
+
+  std::vector<int32_t> in(size);
+  for (size_t i = 0; i < size; i++) {
+    in[i] = static_cast<int32_t>(i % 13) - 6;
+  }
+
+  std::vector<int32_t> inclusive;
+  par_scan_streaming<int32_t, std::plus<int32_t>>(
+      in, inclusive, q, scan_type::inclusive, chunk_size);
+  std::vector<int32_t> exclusive;
+  par_scan_streaming<int32_t, std::plus<int32_t>>(
+      in, exclusive, q, scan_type::exclusive, chunk_size);
+
+  // Compute the same operations using the standard library.
+  std::vector<int32_t> test_inclusive(size);
+  std::inclusive_scan(in.begin(), in.end(), test_inclusive.begin());
+  std::vector<int32_t> test_exclusive(size);
+  std::exclusive_scan(in.begin(), in.end(), test_exclusive.begin(), 0);
+
+  auto ret = check("streaming inclusive sum", inclusive, test_inclusive);
+  if (ret == 0) {
+    ret = check("streaming exclusive sum", exclusive, test_exclusive);
+  }
+  return ret;
+}
+
+/* Tests summed-area tables of images whose sides are not powers of two, out
+ * of place with a sum and in place with a running maximum. Returns 0 if
+ * successful, a nonzero value otherwise. */
+int test_summed_area(sycl::queue& q) {
+  const size_t shapes[][2] = {{1, 1}, {7, 13}, {37, 100}, {129, 3}};
+
+  for (auto& shape : shapes) {
+    size_t height = shape[0];
+    size_t width = shape[1];
+    std::vector<int32_t> in(height * width);
+    for (size_t i = 0; i < in.size(); i++) {
+      in[i] = static_cast<int32_t>((i * 7919) % 201) - 100;
+    }
+
+    std::vector<int32_t> sums(in.size());
+    std::vector<int32_t> maxima = in;
+    {
+      sycl::range<2> range(height, width);
+      sycl::buffer<int32_t, 2> in_buf(in.data(), range);
+      sycl::buffer<int32_t, 2> sum_buf(sums.data(), range);
+      sycl::buffer<int32_t, 2> max_buf(maxima.data(), range);
+      par_scan_2d<int32_t, std::plus<int32_t>>(in_buf, sum_buf, q);
+      par_scan_2d<int32_t, maximum<int32_t>>(max_buf, max_buf, q);
+    }
+
+    // Compute the same tables on the host, row by row.
+    std::vector<int32_t> test_sums(in.size());
+    std::vector<int32_t> test_maxima(in.size());
+    for (size_t y = 0; y < height; y++) {
+      int32_t row_sum = 0;
+      int32_t row_max = identity<int32_t, maximum<int32_t>>::value;
+      for (size_t x = 0; x < width; x++) {
+        size_t i = y * width + x;
+        row_sum += in[i];
+        row_max = std::max(row_max, in[i]);
+        test_sums[i] = row_sum + ((y > 0) ? test_sums[i - width] : 0);
+        test_maxima[i] =
+            (y > 0) ? std::max(row_max, test_maxima[i - width]) : row_max;
+      }
+    }
+
+    int ret = check("summed-area table", sums, test_sums);
+    if (ret == 0) {
+      ret = check("2-D running maximum", maxima, test_maxima);
+    }
+    if (ret != 0) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
 int main() {
   sycl::queue q{sycl::default_selector{}};
 
-  auto ret = test_sum(q);
+  /* Sizes that are not powers of two leave the last work-group of a level
+   * partially filled. */
+  for (auto algorithm : {scan_algorithm::recursive, scan_algorithm::look_back,
+                         scan_algorithm::blocked}) {
+    for (size_t size : {512, 1, 7, 1000, 4099, 50001}) {
+      auto ret = test_sum(q, size, algorithm);
+      if (ret != 0) {
+        return ret;
+      }
+    }
+  }
+  /* One workspace serves repeated scans of its capacity and of smaller
+   * sizes. */
+  scan_workspace<int32_t> workspace(q, 50001);
+  for (auto algorithm : {scan_algorithm::recursive, scan_algorithm::look_back,
+                         scan_algorithm::blocked}) {
+    for (size_t size : {50001, 50001, 4099, 7}) {
+      auto ret = test_sum(q, size, algorithm, &workspace);
+      if (ret != 0) {
+        return ret;
+      }
+    }
+  }
+  // Blockings that do not divide the sizes evenly.
+  for (size_t size : {1, 7, 4099}) {
+    auto ret = test_sum<1>(q, size, scan_algorithm::blocked);
+    if (ret == 0) {
+      ret = test_sum<3>(q, size, scan_algorithm::blocked);
+    }
+    if (ret != 0) {
+      return ret;
+    }
+  }
+  auto ret = test_factorial(q);
+  if (ret != 0) {
+    return ret;
+  }
+  for (auto algorithm : {scan_algorithm::recursive, scan_algorithm::look_back,
+                         scan_algorithm::blocked}) {
+    ret = test_extrema(q, algorithm);
+    if (ret != 0) {
+      return ret;
+    }
+    ret = test_segmented(q, algorithm);
+    if (ret != 0) {
+      return ret;
+    }
+  }
+
+  ret = test_compaction(q);
+  if (ret != 0) {
+    return ret;
+  }
+  ret = test_streaming(q);
   if (ret != 0) {
     return ret;
   }
-  ret = test_factorial(q);
+  ret = test_summed_area(q);
   if (ret != 0) {
     return ret;
   }
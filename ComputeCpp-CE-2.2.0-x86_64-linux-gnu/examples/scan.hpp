@@ -0,0 +1,1517 @@
+/***************************************************************************
+ *
+ *  Copyright (C) 2017 Codeplay Software Limited
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  For your convenience, a copy of the License has been included in this
+ *  repository.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  Codeplay's ComputeCpp SDK
+ *
+ *  scan.hpp
+ *
+ *  Description:
+ *    Parallel inclusive scan in SYCL, either recursive over work-group
+ *    segments or in a single pass with decoupled look-back.
+ *
+ **************************************************************************/
+
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+#include <CL/sycl.hpp>
+namespace sycl = cl::sycl;
+
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "extrema.hpp"
+
+// The identity element for a given operation.
+template <typename T, typename Op>
+struct identity {};
+
+template <typename T>
+struct identity<T, std::plus<T>> {
+  static constexpr T value = 0;
+};
+
+template <typename T>
+struct identity<T, std::multiplies<T>> {
+  static constexpr T value = 1;
+};
+
+template <typename T>
+struct identity<T, std::logical_or<T>> {
+  static constexpr T value = false;
+};
+
+template <typename T>
+struct identity<T, std::logical_and<T>> {
+  static constexpr T value = true;
+};
+
+template <typename T>
+struct identity<T, std::bit_or<T>> {
+  static constexpr T value = 0;
+};
+
+template <typename T>
+struct identity<T, std::bit_and<T>> {
+  static constexpr T value = ~T(0);
+};
+
+template <typename T>
+struct identity<T, std::bit_xor<T>> {
+  static constexpr T value = 0;
+};
+
+/* Binary operations for running-minimum and running-maximum scans, the same
+ * types as the reductions use. */
+using chiu::maximum;
+using chiu::minimum;
+
+template <typename T>
+struct identity<T, minimum<T>> {
+  static constexpr T value = minimum<T>::identity;
+};
+
+template <typename T>
+struct identity<T, maximum<T>> {
+  static constexpr T value = maximum<T>::identity;
+};
+
+// Dummy struct to generate unique kernel name types
+template <typename T, typename U, typename V>
+struct kernel_name {};
+
+// Names the blocked scan kernel for each number of elements per work-item.
+template <size_t K>
+class scan_blocked;
+
+// Whether element i of the result includes input element i.
+enum class scan_type { inclusive, exclusive };
+
+// Selects how `par_scan` propagates results between work-groups.
+enum class scan_algorithm {
+  // Blocked single pass where the device allows it, recursive otherwise.
+  automatic,
+  // One kernel; each work-group looks back at the status of earlier tiles.
+  look_back,
+  // Look-back, with several elements per work-item scanned in registers.
+  blocked,
+  // Scan every segment, then recursively scan and add the segment ends.
+  recursive
+};
+
+// Status of a tile in the look-back scan, stored in an atomic flag per tile.
+constexpr int tile_invalid = 0;    // Nothing published yet.
+constexpr int tile_aggregate = 1;  // Reduction of the tile alone.
+constexpr int tile_prefix = 2;     // Inclusive prefix up to the tile's end.
+
+/* Whether work-groups that wait on earlier work-groups are guaranteed to make
+ * progress. SYCL 1.2.1 has no query for this, so accelerators such as FPGAs,
+ * which may run work-groups in any order without preemption, are assumed not
+ * to. */
+inline bool has_forward_progress(const sycl::device& dev) {
+  return !dev.is_accelerator();
+}
+
+/* Checks that the device can run a scan of `in_size` elements of type T and
+ * returns the work-group size to use. Every work-item processes `per_item`
+ * elements and needs at most two values of local memory. The work-group size
+ * is the largest power of two within the device limit, since the scan tree
+ * needs a power of two, but no larger than needed to cover the input. */
+template <typename T>
+size_t scan_wgroup_size(const sycl::device& dev, size_t in_size,
+                        size_t per_item = 2) {
+  // Check if there is enough global memory.
+  size_t global_mem_size = dev.get_info<sycl::info::device::global_mem_size>();
+  if (!dev.is_host() && in_size > (global_mem_size / 2)) {
+    throw std::runtime_error(
+        "Input size exceeds device global memory size; use "
+        "par_scan_streaming.");
+  }
+
+  /* Check if local memory is available. On host no local memory is fine, since
+   * it is emulated. */
+  if (!dev.is_host() && dev.get_info<sycl::info::device::local_mem_type>() ==
+                            sycl::info::local_mem_type::none) {
+    throw std::runtime_error("Device does not have local memory.");
+  }
+
+  // Obtain device limits.
+  size_t max_wgroup_size =
+      dev.get_info<sycl::info::device::max_work_group_size>();
+  size_t local_mem_size = dev.get_info<sycl::info::device::local_mem_size>();
+
+  /* Find a work-group size that is guaranteed to fit in local memory and is
+   * below the maximum work-group size of the device. */
+  size_t wgroup_size_lim =
+      sycl::min(max_wgroup_size, local_mem_size / (2 * sizeof(T)));
+
+  size_t items = (in_size + per_item - 1) / per_item;
+
+  size_t wgroup_size = 1;
+  while (wgroup_size * 2 <= wgroup_size_lim && wgroup_size < items) {
+    wgroup_size *= 2;
+  }
+  return wgroup_size;
+}
+
+/* Returns element `i` of `acc`, or `id` past the end `n`. Written without a
+ * conditional expression, whose operands would be in different address
+ * spaces. */
+template <typename T, typename Acc>
+T load_or(Acc acc, size_t i, size_t n, T id) {
+  if (i < n) {
+    return acc[i];
+  }
+  return id;
+}
+
+/* Computes the exclusive scan of the first `n` elements in `temp` in place,
+ * where `n` is a power of two and at most twice the work-group size, and `id`
+ * is the identity of `Op`. Two-phase algorithm due to Guy E. Blelloch in
+ * "Prefix Sums and Their Applications", 1990. Earlier elements are always the
+ * left operand, so `Op` need not be commutative. Every work-item of the group
+ * has to call this, and the result is visible to all of them on return. */
+template <typename T, typename Op>
+void scan_local(sycl::nd_item<1> item,
+                sycl::accessor<T, 1, sycl::access::mode::read_write,
+                               sycl::access::target::local>
+                    temp,
+                size_t n, T id) {
+  size_t lid = item.get_local_linear_id();
+
+  /* Perform partial reduction (up-sweep) on the data. The `off` variable is 2
+   * to the power of the current depth of the reduction tree. In the paper,
+   * this corresponds to 2^d. */
+  for (size_t off = 1; off < n; off *= 2) {
+    // Synchronize local memory to observe the previous writes.
+    item.barrier(sycl::access::fence_space::local_space);
+
+    size_t i = lid * off * 2;
+    if (i < n) {
+      temp[i + off * 2 - 1] = Op{}(temp[i + off - 1], temp[i + off * 2 - 1]);
+    }
+  }
+
+  // Clear the last element to the identity before down-sweeping.
+  if (lid == 0) {
+    temp[n - 1] = id;
+  }
+
+  /* Perform down-sweep on the tree to compute the whole scan. Again, `off` is
+   * 2^d. */
+  for (size_t off = n / 2; off > 0; off >>= 1) {
+    item.barrier(sycl::access::fence_space::local_space);
+
+    size_t i = lid * off * 2;
+    if (i < n) {
+      auto t = temp[i + off - 1];
+      auto u = temp[i + off * 2 - 1];
+      temp[i + off - 1] = u;
+      temp[i + off * 2 - 1] = Op{}(u, t);
+    }
+  }
+
+  // Synchronize again to observe results.
+  item.barrier(sycl::access::fence_space::local_space);
+}
+
+template <typename T>
+class scan_workspace;
+
+/* Scan that scans every segment of `wgroup_size * 2` elements of the first
+ * `in_size` elements of `in` into `out` and stores the total of each segment,
+ * then recursively scans the totals and adds them back. Reads and writes
+ * global memory about three times per element. Any input size is supported:
+ * the last work-group of every level may be partial, and its missing elements
+ * are read as `id`. The totals of recursion level `level` are kept in
+ * `workspace` if there is one, and in a new buffer otherwise. */
+template <typename T, typename Op>
+void par_scan_recursive(sycl::buffer<T, 1>& in, sycl::buffer<T, 1>& out,
+                        size_t in_size, sycl::queue& q, T id, scan_type type,
+                        scan_workspace<T>* workspace, size_t level) {
+  if (in_size == 0) {
+    return;
+  }
+
+  size_t wgroup_size = scan_wgroup_size<T>(q.get_device(), in_size);
+  size_t half_in_size = (in_size + 1) / 2;
+  bool exclusive = type == scan_type::exclusive;
+
+  // The last work-group covers whatever is left of the input.
+  size_t n_segments = (half_in_size + wgroup_size - 1) / wgroup_size;
+
+  // Space for the total of each segment.
+  sycl::buffer<T, 1> ends =
+      workspace ? workspace->ends(level)
+                : sycl::buffer<T, 1>(sycl::range<1>(n_segments));
+
+  q.submit([&](sycl::handler& cgh) {
+    auto data_in = in.template get_access<sycl::access::mode::read>(cgh);
+    auto data_out = out.template get_access<sycl::access::mode::write>(cgh);
+    auto elems =
+        ends.template get_access<sycl::access::mode::discard_write>(cgh);
+    sycl::accessor<T, 1, sycl::access::mode::read_write,
+                   sycl::access::target::local>
+
+        temp(wgroup_size * 2, cgh);
+
+    // Use dummy struct as the unique kernel name.
+    cgh.parallel_for<kernel_name<T, Op, class scan_segments>>(
+        sycl::nd_range<1>(n_segments * wgroup_size, wgroup_size),
+        [=](sycl::nd_item<1> item) {
+          size_t gid = item.get_global_linear_id();
+          size_t lid = item.get_local_linear_id();
+
+          /* Read data into local memory. Elements past the end of the input
+           * are replaced by the identity, which leaves the scan of the real
+           * elements unchanged. */
+          temp[2 * lid] = load_or(data_in, 2 * gid, in_size, id);
+          temp[2 * lid + 1] = load_or(data_in, 2 * gid + 1, in_size, id);
+
+          // Preserve the second input element to add at the end.
+          auto second_in = temp[2 * lid + 1];
+
+          scan_local<T, Op>(item, temp, wgroup_size * 2, id);
+
+          /* The local scan is exclusive. To return an inclusive result, shift
+           * each element left by 1 when writing back into global memory. The
+           * last work-item adds on the final element, which gives the total
+           * of the segment. Only elements inside the input are written. */
+          T first = temp[2 * lid];
+          T second = temp[2 * lid + 1];
+          T third = Op{}(second, second_in);
+          if (lid != wgroup_size - 1) {
+            third = temp[2 * lid + 2];
+          }
+
+          if (2 * gid < in_size) {
+            data_out[2 * gid] = exclusive ? first : second;
+          }
+          if (2 * gid + 1 < in_size) {
+            data_out[2 * gid + 1] = exclusive ? second : third;
+          }
+          if (lid == wgroup_size - 1) {
+            elems[item.get_group_linear_id()] = third;
+          }
+        });
+  });
+
+  // At this point we have computed the scans of n_segments segments.
+  if (n_segments == 1) {
+    // If all of the data is in one segment, we're done.
+    return;
+  }
+  // Otherwise we have to propagate the scan results forward into later
+  // segments.
+
+  // Recursively scan the array of segment totals.
+  par_scan_recursive<T, Op>(ends, ends, n_segments, q, id,
+                            scan_type::inclusive, workspace, level + 1);
+
+  // Add the results of the scan to each segment.
+  q.submit([&](sycl::handler& cgh) {
+    auto ends_scan = ends.template get_access<sycl::access::mode::read>(cgh);
+    auto data = out.template get_access<sycl::access::mode::read_write>(cgh);
+
+    cgh.parallel_for<kernel_name<T, Op, class add_ends>>(
+        // Work with one less work-group, since the first segment is correct.
+        sycl::nd_range<1>((n_segments - 1) * wgroup_size, wgroup_size),
+        [=](sycl::nd_item<1> item) {
+          auto group = item.get_group_linear_id();
+
+          // Start with the second segment.
+          auto off_gid = item.get_global_linear_id() + wgroup_size;
+
+          /* Each work-group combines the corresponding number in the
+           * "segment total scan" array with every element in the group's
+           * segment, keeping the earlier segments on the left. */
+          T prefix = ends_scan[group];
+          if (off_gid * 2 < in_size) {
+            T value = data[off_gid * 2];
+            data[off_gid * 2] = Op{}(prefix, value);
+          }
+          if (off_gid * 2 + 1 < in_size) {
+            T value = data[off_gid * 2 + 1];
+            data[off_gid * 2 + 1] = Op{}(prefix, value);
+          }
+        });
+  });
+}
+
+/* Per-tile state of a look-back scan over up to `n_tiles` tiles: an atomic
+ * status flag, the published aggregate and inclusive prefix of every tile, and
+ * the counter handing out tiles to work-groups. The flags and the counter are
+ * cleared on construction and by `clear`. */
+template <typename T>
+struct look_back_state {
+  sycl::buffer<int, 1> flags;
+  sycl::buffer<int, 1> counter;
+  sycl::buffer<T, 1> aggregates;
+  sycl::buffer<T, 1> inclusive;
+
+  look_back_state(sycl::queue& q, size_t n_tiles)
+      : flags(sycl::range<1>(n_tiles)),
+        counter(sycl::range<1>(1)),
+        aggregates(sycl::range<1>(n_tiles)),
+        inclusive(sycl::range<1>(n_tiles)) {
+    clear(q);
+  }
+
+  // Prepares the state for another scan.
+  void clear(sycl::queue& q) {
+    q.submit([&](sycl::handler& cgh) {
+      auto acc = flags.get_access<sycl::access::mode::discard_write>(cgh);
+      cgh.fill(acc, tile_invalid);
+    });
+    q.submit([&](sycl::handler& cgh) {
+      auto acc = counter.get_access<sycl::access::mode::discard_write>(cgh);
+      cgh.fill(acc, 0);
+    });
+  }
+};
+
+/* Intermediate storage for scans of up to `capacity()` elements of type T on
+ * the device of a given queue. The recursive scan needs a buffer of segment
+ * totals per level; the hierarchy of levels is worked out for the capacity
+ * and all of them are allocated once. The look-back scans need per-tile state,
+ * allocated for the largest number of tiles any blocking can use. Passing the
+ * workspace to `par_scan` reuses this storage across calls of the same or a
+ * smaller size instead of allocating it on every call, and the compactions
+ * (`par_copy_if` and friends) take their tile state from a workspace of
+ * size_t. Scans that share a workspace must not run concurrently; commands
+ * on its buffers are ordered by the runtime. */
+template <typename T>
+class scan_workspace {
+ public:
+  scan_workspace(sycl::queue& q, size_t capacity)
+      : capacity_(capacity), look_back_(q, max_tiles(q, capacity)) {
+    /* A smaller input never has more segments at any level, since the
+     * work-group size only shrinks once a single segment covers the input. */
+    sycl::device dev = q.get_device();
+    size_t size = capacity;
+    while (size > 0) {
+      size_t wgroup_size = scan_wgroup_size<T>(dev, size);
+      size_t n_segments = ((size + 1) / 2 + wgroup_size - 1) / wgroup_size;
+      ends_.emplace_back(sycl::range<1>(n_segments));
+      size = (n_segments > 1) ? n_segments : 0;
+    }
+  }
+
+  size_t capacity() const { return capacity_; }
+
+  // Number of recursion levels of a recursive scan of `capacity()` elements.
+  size_t levels() const { return ends_.size(); }
+
+  // Segment totals of recursion level `level`.
+  sycl::buffer<T, 1>& ends(size_t level) { return ends_[level]; }
+
+  // Tile state for a look-back scan, cleared on q.
+  look_back_state<T>& look_back(sycl::queue& q) {
+    look_back_.clear(q);
+    return look_back_;
+  }
+
+ private:
+  /* One element per work-item gives the most tiles, and smaller inputs never
+   * use more. */
+  static size_t max_tiles(sycl::queue& q, size_t capacity) {
+    if (capacity == 0) {
+      return 1;
+    }
+    size_t wgroup_size = scan_wgroup_size<T>(q.get_device(), capacity, 1);
+    return (capacity + wgroup_size - 1) / wgroup_size;
+  }
+
+  size_t capacity_;
+  look_back_state<T> look_back_;
+  std::vector<sycl::buffer<T, 1>> ends_;
+};
+
+/* Publishes the `aggregate` of `tile` and returns the combined value of all
+ * earlier tiles, or `id` for the first, after publishing the tile's own
+ * inclusive prefix. Called by one work-item per tile. Values are written
+ * before their flag, with a global fence in between, and read after seeing the
+ * flag. */
+template <typename T, typename Op, typename Status, typename Values>
+T look_back(sycl::nd_item<1> item, Status status, Values aggregates,
+            Values inclusive, size_t tile, T aggregate, T id) {
+  T prefix = id;
+
+  if (tile == 0) {
+    inclusive[0] = aggregate;
+    item.mem_fence(sycl::access::fence_space::global_space);
+    status[0].store(tile_prefix);
+    return prefix;
+  }
+
+  aggregates[tile] = aggregate;
+  item.mem_fence(sycl::access::fence_space::global_space);
+  status[tile].store(tile_aggregate);
+
+  /* Walk back until a tile with an inclusive prefix is found. The first tile
+   * always publishes one. */
+  size_t pred = tile;
+  bool found = false;
+  while (!found) {
+    --pred;
+    int pred_status = status[pred].load();
+    while (pred_status == tile_invalid) {
+      pred_status = status[pred].load();
+    }
+    item.mem_fence(sycl::access::fence_space::global_space);
+
+    if (pred_status == tile_prefix) {
+      T value = inclusive[pred];
+      prefix = Op{}(value, prefix);
+      found = true;
+    } else {
+      T value = aggregates[pred];
+      prefix = Op{}(value, prefix);
+    }
+  }
+
+  inclusive[tile] = Op{}(prefix, aggregate);
+  item.mem_fence(sycl::access::fence_space::global_space);
+  status[tile].store(tile_prefix);
+  return prefix;
+}
+
+/* Inclusive scan in a single kernel launch using decoupled look-back, after
+ * Merrill and Garland, "Single-pass Parallel Prefix Scan with Decoupled
+ * Look-back", 2016. Every element is read and written once.
+ *
+ * Each work-group takes the next tile of `wgroup_size * 2` elements from an
+ * atomic counter, so tiles are started in order, and scans it in local memory.
+ * It then publishes the tile's aggregate, walks back over the published
+ * status of earlier tiles until it finds an inclusive prefix, and publishes
+ * its own inclusive prefix. A tile only ever waits on tiles that started
+ * before it, which requires those to keep making progress; see
+ * `has_forward_progress`. */
+template <typename T, typename Op>
+void par_scan_look_back(sycl::buffer<T, 1>& in, sycl::buffer<T, 1>& out,
+                        sycl::queue& q, T id, scan_type type,
+                        scan_workspace<T>* workspace = nullptr) {
+  size_t in_size = in.get_count();
+  if (in_size == 0) {
+    return;
+  }
+  bool exclusive = type == scan_type::exclusive;
+
+  size_t wgroup_size = scan_wgroup_size<T>(q.get_device(), in_size);
+  size_t half_in_size = (in_size + 1) / 2;
+  size_t n_tiles = (half_in_size + wgroup_size - 1) / wgroup_size;
+
+  look_back_state<T> state =
+      workspace ? workspace->look_back(q) : look_back_state<T>(q, n_tiles);
+
+  q.submit([&](sycl::handler& cgh) {
+    auto data_in = in.template get_access<sycl::access::mode::read>(cgh);
+    auto data_out = out.template get_access<sycl::access::mode::write>(cgh);
+    auto status =
+        state.flags.template get_access<sycl::access::mode::atomic>(cgh);
+    auto next_tile =
+        state.counter.template get_access<sycl::access::mode::atomic>(cgh);
+    auto tile_aggregates =
+        state.aggregates.template get_access<sycl::access::mode::read_write>(
+            cgh);
+    auto tile_inclusive =
+        state.inclusive.template get_access<sycl::access::mode::read_write>(
+            cgh);
+
+    sycl::accessor<T, 1, sycl::access::mode::read_write,
+                   sycl::access::target::local>
+        temp(wgroup_size * 2, cgh);
+    sycl::accessor<int, 1, sycl::access::mode::read_write,
+                   sycl::access::target::local>
+        tile_id(1, cgh);
+    sycl::accessor<T, 1, sycl::access::mode::read_write,
+                   sycl::access::target::local>
+        tile_prefix_in(1, cgh);
+
+    cgh.parallel_for<kernel_name<T, Op, class scan_look_back>>(
+        sycl::nd_range<1>(n_tiles * wgroup_size, wgroup_size),
+        [=](sycl::nd_item<1> item) {
+          size_t lid = item.get_local_linear_id();
+
+          // Take the next tile in the order the work-groups started.
+          if (lid == 0) {
+            tile_id[0] = next_tile[0].fetch_add(1);
+          }
+          item.barrier(sycl::access::fence_space::local_space);
+
+          size_t tile = tile_id[0];
+          size_t gid = tile * wgroup_size + lid;
+
+          // Read the tile into local memory, padding with the identity.
+          temp[2 * lid] = load_or(data_in, 2 * gid, in_size, id);
+          temp[2 * lid + 1] = load_or(data_in, 2 * gid + 1, in_size, id);
+
+          // Preserve the second input element to add at the end.
+          auto second_in = temp[2 * lid + 1];
+
+          scan_local<T, Op>(item, temp, wgroup_size * 2, id);
+
+          // The last work-item holds the tile's aggregate and looks back.
+          if (lid == wgroup_size - 1) {
+            T aggregate = Op{}(temp[2 * lid + 1], second_in);
+            tile_prefix_in[0] =
+                look_back<T, Op>(item, status, tile_aggregates,
+                                 tile_inclusive, tile, aggregate, id);
+          }
+          item.barrier(sycl::access::fence_space::local_space);
+
+          T prefix = tile_prefix_in[0];
+
+          /* Write back the result as in `par_scan_recursive`, combined with
+           * the prefix of earlier tiles. */
+          T first = temp[2 * lid];
+          T second = temp[2 * lid + 1];
+          T third = Op{}(second, second_in);
+          if (lid != wgroup_size - 1) {
+            third = temp[2 * lid + 2];
+          }
+
+          if (2 * gid < in_size) {
+            data_out[2 * gid] = Op{}(prefix, exclusive ? first : second);
+          }
+          if (2 * gid + 1 < in_size) {
+            data_out[2 * gid + 1] = Op{}(prefix, exclusive ? second : third);
+          }
+        });
+  });
+}
+
+/* Number of consecutive elements each work-item of `par_scan_blocked` scans
+ * in registers by default: 32 bytes' worth, and at least two. Specialize it
+ * for types that need a different blocking. */
+template <typename T>
+struct scan_items_per_work_item {
+  static constexpr size_t value = sizeof(T) >= 16 ? 2 : 32 / sizeof(T);
+};
+
+/* Single-pass look-back scan in which every work-item scans `K` consecutive
+ * elements in registers. Only the per-item totals are scanned across the
+ * work-group in local memory, so a tile of `wgroup_size * K` elements needs
+ * the barriers of a `wgroup_size` element tree instead of a `wgroup_size * 2`
+ * one, and local memory holds one value per work-item. */
+template <typename T, typename Op, size_t K>
+void par_scan_blocked(sycl::buffer<T, 1>& in, sycl::buffer<T, 1>& out,
+                      sycl::queue& q, T id, scan_type type,
+                      scan_workspace<T>* workspace = nullptr) {
+  static_assert(K > 0, "Each work-item needs at least one element.");
+
+  size_t in_size = in.get_count();
+  if (in_size == 0) {
+    return;
+  }
+  bool exclusive = type == scan_type::exclusive;
+
+  size_t wgroup_size = scan_wgroup_size<T>(q.get_device(), in_size, K);
+  size_t items = (in_size + K - 1) / K;
+  size_t n_tiles = (items + wgroup_size - 1) / wgroup_size;
+
+  look_back_state<T> state =
+      workspace ? workspace->look_back(q) : look_back_state<T>(q, n_tiles);
+
+  q.submit([&](sycl::handler& cgh) {
+    auto data_in = in.template get_access<sycl::access::mode::read>(cgh);
+    auto data_out = out.template get_access<sycl::access::mode::write>(cgh);
+    auto status =
+        state.flags.template get_access<sycl::access::mode::atomic>(cgh);
+    auto next_tile =
+        state.counter.template get_access<sycl::access::mode::atomic>(cgh);
+    auto tile_aggregates =
+        state.aggregates.template get_access<sycl::access::mode::read_write>(
+            cgh);
+    auto tile_inclusive =
+        state.inclusive.template get_access<sycl::access::mode::read_write>(
+            cgh);
+
+    sycl::accessor<T, 1, sycl::access::mode::read_write,
+                   sycl::access::target::local>
+        temp(wgroup_size, cgh);
+    sycl::accessor<int, 1, sycl::access::mode::read_write,
+                   sycl::access::target::local>
+        tile_id(1, cgh);
+    sycl::accessor<T, 1, sycl::access::mode::read_write,
+                   sycl::access::target::local>
+        tile_prefix_in(1, cgh);
+
+    cgh.parallel_for<kernel_name<T, Op, scan_blocked<K>>>(
+        sycl::nd_range<1>(n_tiles * wgroup_size, wgroup_size),
+        [=](sycl::nd_item<1> item) {
+          size_t lid = item.get_local_linear_id();
+
+          // Take the next tile in the order the work-groups started.
+          if (lid == 0) {
+            tile_id[0] = next_tile[0].fetch_add(1);
+          }
+          item.barrier(sycl::access::fence_space::local_space);
+
+          size_t tile = tile_id[0];
+          size_t first = (tile * wgroup_size + lid) * K;
+
+          /* Scan this work-item's elements in registers, padding with the
+           * identity past the end of the input. */
+          T scanned[K];
+          T total = id;
+          for (size_t k = 0; k < K; k++) {
+            T value = load_or(data_in, first + k, in_size, id);
+            total = Op{}(total, value);
+            scanned[k] = total;
+          }
+
+          // Exclusive scan of the per-item totals.
+          temp[lid] = total;
+          scan_local<T, Op>(item, temp, wgroup_size, id);
+
+          // The last work-item holds the tile's aggregate and looks back.
+          if (lid == wgroup_size - 1) {
+            T before = temp[lid];
+            T aggregate = Op{}(before, total);
+            tile_prefix_in[0] =
+                look_back<T, Op>(item, status, tile_aggregates,
+                                 tile_inclusive, tile, aggregate, id);
+          }
+          item.barrier(sycl::access::fence_space::local_space);
+
+          T prefix = tile_prefix_in[0];
+          T before = temp[lid];
+          T offset = Op{}(prefix, before);
+
+          /* The exclusive result of an element is the inclusive result of
+           * the one before it. */
+          for (size_t k = 0; k < K; k++) {
+            if (first + k < in_size) {
+              T value = exclusive ? ((k == 0) ? id : scanned[k - 1])
+                                  : scanned[k];
+              data_out[first + k] = Op{}(offset, value);
+            }
+          }
+        });
+  });
+}
+
+/* Scans `in` into `out` with the associative binary operation `Op`, whose
+ * identity is `id`. Runs in parallel on the provided accelerated hardware
+ * queue. `in` and `out` must have the same size and may be the same buffer.
+ * Any input size is supported. By default the blocked single-pass scan is
+ * used, falling back to the recursive scan on devices without forward-progress
+ * guarantees between work-groups. `K` is the number of elements per work-item
+ * of the blocked scan. Intermediate storage comes from `workspace` if given,
+ * which must have been made for the same device and at least this size. */
+template <typename T, typename Op,
+          size_t K = scan_items_per_work_item<T>::value>
+void par_scan(sycl::buffer<T, 1>& in, sycl::buffer<T, 1>& out, sycl::queue& q,
+              T id, scan_type type = scan_type::inclusive,
+              scan_algorithm algorithm = scan_algorithm::automatic,
+              scan_workspace<T>* workspace = nullptr) {
+  if (in.get_count() != out.get_count()) {
+    throw std::runtime_error("Scan input and output sizes differ.");
+  }
+  if (workspace && workspace->capacity() < in.get_count()) {
+    throw std::runtime_error("Scan input exceeds the workspace capacity.");
+  }
+
+  if (algorithm != scan_algorithm::recursive &&
+      !has_forward_progress(q.get_device())) {
+    algorithm = scan_algorithm::recursive;
+  } else if (algorithm == scan_algorithm::automatic) {
+    algorithm = scan_algorithm::blocked;
+  }
+
+  if (algorithm == scan_algorithm::look_back) {
+    par_scan_look_back<T, Op>(in, out, q, id, type, workspace);
+  } else if (algorithm == scan_algorithm::blocked) {
+    par_scan_blocked<T, Op, K>(in, out, q, id, type, workspace);
+  } else {
+    par_scan_recursive<T, Op>(in, out, in.get_count(), q, id, type, workspace,
+                              0);
+  }
+}
+
+/* Performs an inclusive scan with the given associative binary operation `Op`
+ * on the data in the `in` buffer, using the identity from `identity<T, Op>`.
+ * Modifies the input buffer to contain the results of the scan. */
+template <typename T, typename Op,
+          size_t K = scan_items_per_work_item<T>::value>
+void par_scan(sycl::buffer<T, 1>& in, sycl::queue& q,
+              scan_algorithm algorithm = scan_algorithm::automatic) {
+  par_scan<T, Op, K>(in, in, q, identity<T, Op>::value, scan_type::inclusive,
+                     algorithm);
+}
+
+/* In-place inclusive scan, using the identity from `identity<T, Op>` and the
+ * storage of `workspace`. */
+template <typename T, typename Op,
+          size_t K = scan_items_per_work_item<T>::value>
+void par_scan(sycl::buffer<T, 1>& in, sycl::queue& q,
+              scan_workspace<T>& workspace,
+              scan_algorithm algorithm = scan_algorithm::automatic) {
+  par_scan<T, Op, K>(in, in, q, identity<T, Op>::value, scan_type::inclusive,
+                     algorithm, &workspace);
+}
+
+// Inclusive scan of `in` into `out`, using the identity from `identity<T, Op>`.
+template <typename T, typename Op,
+          size_t K = scan_items_per_work_item<T>::value>
+void par_scan(sycl::buffer<T, 1>& in, sycl::buffer<T, 1>& out, sycl::queue& q,
+              scan_algorithm algorithm = scan_algorithm::automatic) {
+  par_scan<T, Op, K>(in, out, q, identity<T, Op>::value, scan_type::inclusive,
+                     algorithm);
+}
+
+/* Exclusive scan of `in` into `out`: element i of `out` combines the elements
+ * before i, and the first element is the identity from `identity<T, Op>`. */
+template <typename T, typename Op,
+          size_t K = scan_items_per_work_item<T>::value>
+void par_exclusive_scan(sycl::buffer<T, 1>& in, sycl::buffer<T, 1>& out,
+                        sycl::queue& q,
+                        scan_algorithm algorithm = scan_algorithm::automatic) {
+  par_scan<T, Op, K>(in, out, q, identity<T, Op>::value, scan_type::exclusive,
+                     algorithm);
+}
+
+// Names the carry kernel of a streaming scan for each blocking of its chunks.
+template <size_t K>
+class stream_carry;
+
+/* Scans `size` elements of host memory at `in` into host memory at `out`
+ * (which may be the same) in chunks of `chunk_size` elements, so the input
+ * may be larger than device memory. `Op` has identity `id`. A chunk size of 0
+ * picks the largest one for which the device buffers take at most half of the
+ * device's global memory.
+ *
+ * Two sets of device buffers alternate between chunks. Each chunk is copied
+ * in, scanned with `par_scan` and combined with the running total of the
+ * earlier chunks, which stays on the device, before it is copied out. The
+ * runtime orders commands only by the buffers they use, so the copies of one
+ * chunk can overlap the kernels of its neighbour. Returns once `out` holds
+ * the whole result. */
+template <typename T, typename Op,
+          size_t K = scan_items_per_work_item<T>::value>
+void par_scan_streaming(const T* in, T* out, size_t size, sycl::queue& q, T id,
+                        scan_type type = scan_type::inclusive,
+                        size_t chunk_size = 0,
+                        scan_algorithm algorithm = scan_algorithm::automatic) {
+  if (size == 0) {
+    return;
+  }
+  bool exclusive = type == scan_type::exclusive;
+
+  if (chunk_size == 0) {
+    /* Four chunk buffers and a workspace of similar size fit in half of the
+     * global memory. */
+    size_t global_mem_size =
+        q.get_device().get_info<sycl::info::device::global_mem_size>();
+    chunk_size = sycl::max(global_mem_size / (10 * sizeof(T)), size_t(1));
+  }
+  chunk_size = sycl::min(chunk_size, size);
+
+  // Device memory for two chunks in flight: the scanned input and the result.
+  sycl::range<1> chunk_range(chunk_size);
+  sycl::buffer<T, 1> scanned[2] = {sycl::buffer<T, 1>(chunk_range),
+                                   sycl::buffer<T, 1>(chunk_range)};
+  sycl::buffer<T, 1> results[2] = {sycl::buffer<T, 1>(chunk_range),
+                                   sycl::buffer<T, 1>(chunk_range)};
+  // Running totals before and after the current chunk.
+  sycl::buffer<T, 1> carries[2] = {sycl::buffer<T, 1>(sycl::range<1>(1)),
+                                   sycl::buffer<T, 1>(sycl::range<1>(1))};
+  scan_workspace<T> workspace(q, chunk_size);
+
+  q.submit([&](sycl::handler& cgh) {
+    auto acc =
+        carries[0].template get_access<sycl::access::mode::discard_write>(cgh);
+    cgh.fill(acc, id);
+  });
+
+  size_t n_chunks = (size + chunk_size - 1) / chunk_size;
+  for (size_t c = 0; c < n_chunks; c++) {
+    size_t offset = c * chunk_size;
+    size_t len = sycl::min(chunk_size, size - offset);
+    sycl::buffer<T, 1>& carry_in = carries[c % 2];
+    sycl::buffer<T, 1>& carry_out = carries[(c + 1) % 2];
+
+    /* A shorter last chunk gets buffers of its own: commands on a sub-buffer
+     * are not ordered against earlier ones on its parent. */
+    bool full = len == chunk_size;
+    sycl::buffer<T, 1> chunk =
+        full ? scanned[c % 2] : sycl::buffer<T, 1>(sycl::range<1>(len));
+    sycl::buffer<T, 1> result =
+        full ? results[c % 2] : sycl::buffer<T, 1>(sycl::range<1>(len));
+
+    q.submit([&](sycl::handler& cgh) {
+      auto acc = chunk.template get_access<sycl::access::mode::discard_write>(
+          cgh);
+      cgh.copy(in + offset, acc);
+    });
+
+    par_scan<T, Op, K>(chunk, chunk, q, id, scan_type::inclusive, algorithm,
+                       &workspace);
+
+    /* Combine with the running total. An exclusive result is the inclusive
+     * one of the element before, and the last element carries the total to
+     * the next chunk. */
+    q.submit([&](sycl::handler& cgh) {
+      auto incl = chunk.template get_access<sycl::access::mode::read>(cgh);
+      auto res =
+          result.template get_access<sycl::access::mode::discard_write>(cgh);
+      auto before = carry_in.template get_access<sycl::access::mode::read>(cgh);
+      auto after =
+          carry_out.template get_access<sycl::access::mode::discard_write>(cgh);
+
+      cgh.parallel_for<kernel_name<T, Op, stream_carry<K>>>(
+          sycl::range<1>(len), [=](sycl::item<1> item) {
+            size_t i = item.get_linear_id();
+            T total = before[0];
+            T value = incl[i];
+            if (!exclusive) {
+              res[i] = Op{}(total, value);
+            } else if (i == 0) {
+              res[i] = total;
+            } else {
+              T prev = incl[i - 1];
+              res[i] = Op{}(total, prev);
+            }
+            if (i == len - 1) {
+              after[0] = Op{}(total, value);
+            }
+          });
+    });
+
+    q.submit([&](sycl::handler& cgh) {
+      auto acc = result.template get_access<sycl::access::mode::read>(cgh);
+      cgh.copy(acc, out + offset);
+    });
+  }
+
+  q.wait_and_throw();
+}
+
+// Streaming scan of `in` into `out`, using the identity from `identity<T, Op>`.
+template <typename T, typename Op,
+          size_t K = scan_items_per_work_item<T>::value>
+void par_scan_streaming(const std::vector<T>& in, std::vector<T>& out,
+                        sycl::queue& q, scan_type type = scan_type::inclusive,
+                        size_t chunk_size = 0,
+                        scan_algorithm algorithm = scan_algorithm::automatic) {
+  out.resize(in.size());
+  par_scan_streaming<T, Op, K>(in.data(), out.data(), in.size(), q,
+                               identity<T, Op>::value, type, chunk_size,
+                               algorithm);
+}
+
+/* Side of the square tiles of a 2-D scan of `n` elements: the largest power
+ * of two up to 16 whose square fits the work-group size a scan of `n`
+ * elements would use, which also leaves room in local memory for a tile and
+ * a carry per line. */
+template <typename T>
+size_t scan_2d_tile(const sycl::device& dev, size_t n) {
+  size_t wgroup_size = scan_wgroup_size<T>(dev, n, 1);
+  size_t tile = 1;
+  while (tile < 16 && (tile * 2) * (tile * 2) <= wgroup_size) {
+    tile *= 2;
+  }
+  return tile;
+}
+
+// Names the kernels of the row and the column pass of a 2-D scan.
+template <bool Rows>
+class scan_2d_lines;
+
+/* Inclusive scan of every row of `in` into `out` if `Rows`, of every column
+ * otherwise, with `Op` of identity `id`. A work-group of `tile` x `tile`
+ * work-items owns a band of `tile` lines and walks along it one square tile
+ * at a time: it loads the tile row by row in either direction, scans its
+ * lines in local memory and combines them with the totals carried over from
+ * the previous tile. `in` and `out` may be the same buffer. */
+template <typename T, typename Op, bool Rows>
+void par_scan_2d_lines(sycl::buffer<T, 2>& in, sycl::buffer<T, 2>& out,
+                       sycl::queue& q, T id, size_t tile) {
+  size_t height = in.get_range()[0];
+  size_t width = in.get_range()[1];
+  size_t n_bands = ((Rows ? height : width) + tile - 1) / tile;
+  size_t n_steps = ((Rows ? width : height) + tile - 1) / tile;
+  sycl::range<2> global_range = Rows ? sycl::range<2>(n_bands * tile, tile)
+                                     : sycl::range<2>(tile, n_bands * tile);
+
+  q.submit([&](sycl::handler& cgh) {
+    auto data_in = in.template get_access<sycl::access::mode::read>(cgh);
+    auto data_out = out.template get_access<sycl::access::mode::write>(cgh);
+
+    sycl::accessor<T, 1, sycl::access::mode::read_write,
+                   sycl::access::target::local>
+        lines(sycl::range<1>(tile * tile), cgh);
+    sycl::accessor<T, 1, sycl::access::mode::read_write,
+                   sycl::access::target::local>
+        carries(sycl::range<1>(tile), cgh);
+
+    cgh.parallel_for<kernel_name<T, Op, scan_2d_lines<Rows>>>(
+        sycl::nd_range<2>(global_range, sycl::range<2>(tile, tile)),
+        [=](sycl::nd_item<2> item) {
+          size_t ty = item.get_local_id(0);
+          size_t tx = item.get_local_id(1);
+          size_t band = item.get_group(Rows ? 0 : 1);
+
+          // Position along the scanned line, and the line within the band.
+          size_t lane = Rows ? tx : ty;
+          size_t line = Rows ? ty : tx;
+          size_t idx = line * tile + lane;
+
+          if (lane == 0) {
+            carries[line] = id;
+          }
+
+          for (size_t step = 0; step < n_steps; step++) {
+            size_t y = Rows ? band * tile + ty : step * tile + ty;
+            size_t x = Rows ? step * tile + tx : band * tile + tx;
+            bool inside = y < height && x < width;
+
+            T value = id;
+            if (inside) {
+              value = data_in[sycl::id<2>(y, x)];
+            }
+            lines[idx] = value;
+
+            /* Hillis-Steele scan of every line of the tile. Earlier elements
+             * are the left operand, and lanes with nothing to add combine
+             * with the identity. */
+            for (size_t off = 1; off < tile; off *= 2) {
+              item.barrier(sycl::access::fence_space::local_space);
+              T left = id;
+              if (lane >= off) {
+                left = lines[idx - off];
+              }
+              item.barrier(sycl::access::fence_space::local_space);
+              value = Op{}(left, value);
+              lines[idx] = value;
+            }
+            item.barrier(sycl::access::fence_space::local_space);
+
+            T carry = carries[line];
+            T result = Op{}(carry, value);
+            if (inside) {
+              data_out[sycl::id<2>(y, x)] = result;
+            }
+
+            // Every lane has read the carry before the last one replaces it.
+            item.barrier(sycl::access::fence_space::local_space);
+            if (lane == tile - 1) {
+              carries[line] = result;
+            }
+          }
+        });
+  });
+}
+
+/* Computes the 2-D inclusive scan of `in` into `out`, which have the same
+ * size and may be the same buffer: element (y, x) of `out` combines the
+ * elements of `in` in rows 0 to y and columns 0 to x with `Op`, whose
+ * identity is `id`. With std::plus this is the summed-area table, or integral
+ * image. `Op` has to be commutative as well as associative, since the
+ * elements are not combined in row-major order. Every row is scanned, then
+ * every column of the result in place; both passes read and write square
+ * tiles along rows, so the column pass needs no transpose. Any width and
+ * height are supported. */
+template <typename T, typename Op>
+void par_scan_2d(sycl::buffer<T, 2>& in, sycl::buffer<T, 2>& out,
+                 sycl::queue& q, T id) {
+  if (in.get_range()[0] != out.get_range()[0] ||
+      in.get_range()[1] != out.get_range()[1]) {
+    throw std::runtime_error("Scan input and output sizes differ.");
+  }
+  size_t size = in.get_count();
+  if (size == 0) {
+    return;
+  }
+
+  size_t tile = scan_2d_tile<T>(q.get_device(), size);
+  par_scan_2d_lines<T, Op, true>(in, out, q, id, tile);
+  par_scan_2d_lines<T, Op, false>(out, out, q, id, tile);
+}
+
+// 2-D inclusive scan using the identity from `identity<T, Op>`.
+template <typename T, typename Op>
+void par_scan_2d(sycl::buffer<T, 2>& in, sycl::buffer<T, 2>& out,
+                 sycl::queue& q) {
+  par_scan_2d<T, Op>(in, out, q, identity<T, Op>::value);
+}
+
+/* An element of a segmented scan: a value and whether it starts a segment. */
+template <typename T>
+struct segmented_value {
+  T value;
+  int head;
+};
+
+/* Lifts `Op` to segmented values, so that a plain scan restarts at every head.
+ * Combining with an element that starts a segment discards everything to its
+ * left, which keeps the operation associative. */
+template <typename T, typename Op>
+struct segmented_op {
+  segmented_value<T> operator()(segmented_value<T> a,
+                                segmented_value<T> b) const {
+    segmented_value<T> result;
+    result.value = b.head ? b.value : Op{}(a.value, b.value);
+    result.head = a.head | b.head;
+    return result;
+  }
+};
+
+/* Name the kernels of a segmented scan for each number of elements per
+ * work-item of its packed scan. */
+template <size_t K>
+class segmented_pack;
+
+template <size_t K>
+class segmented_unpack;
+
+template <size_t K>
+class offsets_to_heads;
+
+/* Scans every segment of `in` independently into `out` with `Op`, whose
+ * identity is `id`. A nonzero entry in `heads` starts a new segment at that
+ * position, so boundaries may fall anywhere, including inside a work-group;
+ * the first element always starts one. All segments are processed by the same
+ * three launches: packing values and flags, one `par_scan` over the packed
+ * elements with `segmented_op`, and unpacking. `in` and `out` may be the same
+ * buffer. */
+template <typename T, typename Op,
+          size_t K = scan_items_per_work_item<segmented_value<T>>::value>
+void par_segmented_scan(sycl::buffer<T, 1>& in, sycl::buffer<int, 1>& heads,
+                        sycl::buffer<T, 1>& out, sycl::queue& q, T id,
+                        scan_type type = scan_type::inclusive,
+                        scan_algorithm algorithm = scan_algorithm::automatic) {
+  size_t in_size = in.get_count();
+  if (heads.get_count() != in_size || out.get_count() != in_size) {
+    throw std::runtime_error("Segmented scan buffer sizes differ.");
+  }
+  if (in_size == 0) {
+    return;
+  }
+  bool exclusive = type == scan_type::exclusive;
+
+  sycl::buffer<segmented_value<T>, 1> packed{sycl::range<1>(in_size)};
+
+  q.submit([&](sycl::handler& cgh) {
+    auto values = in.template get_access<sycl::access::mode::read>(cgh);
+    auto flags = heads.get_access<sycl::access::mode::read>(cgh);
+    auto elems =
+        packed.template get_access<sycl::access::mode::discard_write>(cgh);
+
+    cgh.parallel_for<kernel_name<T, Op, segmented_pack<K>>>(
+        sycl::range<1>(in_size), [=](sycl::item<1> item) {
+          segmented_value<T> elem;
+          elem.value = values[item];
+          elem.head = (flags[item] != 0) ? 1 : 0;
+          elems[item] = elem;
+        });
+  });
+
+  /* The segment flags are scanned along with the values, so the exclusive
+   * result is the inclusive one shifted by an element and restarts are
+   * handled when unpacking. */
+  segmented_value<T> packed_id;
+  packed_id.value = id;
+  packed_id.head = 0;
+  par_scan<segmented_value<T>, segmented_op<T, Op>, K>(
+      packed, packed, q, packed_id, type, algorithm);
+
+  q.submit([&](sycl::handler& cgh) {
+    auto elems = packed.template get_access<sycl::access::mode::read>(cgh);
+    auto flags = heads.get_access<sycl::access::mode::read>(cgh);
+    auto values = out.template get_access<sycl::access::mode::write>(cgh);
+
+    cgh.parallel_for<kernel_name<T, Op, segmented_unpack<K>>>(
+        sycl::range<1>(in_size), [=](sycl::item<1> item) {
+          // An exclusive scan starts every segment from the identity.
+          segmented_value<T> elem = elems[item];
+          values[item] = (exclusive && flags[item] != 0) ? id : elem.value;
+        });
+  });
+}
+
+// Segmented scan using the identity from `identity<T, Op>`.
+template <typename T, typename Op,
+          size_t K = scan_items_per_work_item<segmented_value<T>>::value>
+void par_segmented_scan(sycl::buffer<T, 1>& in, sycl::buffer<int, 1>& heads,
+                        sycl::buffer<T, 1>& out, sycl::queue& q,
+                        scan_type type = scan_type::inclusive,
+                        scan_algorithm algorithm = scan_algorithm::automatic) {
+  par_segmented_scan<T, Op, K>(in, heads, out, q, identity<T, Op>::value, type,
+                               algorithm);
+}
+
+/* Segmented scan whose segments are given by CSR-style `offsets`: segment s
+ * covers [offsets[s], offsets[s + 1]), and the last offset is the size of
+ * `in`. Empty segments are allowed. The offsets are turned into head flags and
+ * passed to the flag-based scan. */
+template <typename T, typename Op,
+          size_t K = scan_items_per_work_item<segmented_value<T>>::value>
+void par_segmented_scan_offsets(
+    sycl::buffer<T, 1>& in, sycl::buffer<size_t, 1>& offsets,
+    sycl::buffer<T, 1>& out, sycl::queue& q, T id,
+    scan_type type = scan_type::inclusive,
+    scan_algorithm algorithm = scan_algorithm::automatic) {
+  size_t in_size = in.get_count();
+  if (in_size == 0 || offsets.get_count() < 2) {
+    return;
+  }
+  size_t n_segments = offsets.get_count() - 1;
+
+  sycl::buffer<int, 1> heads{sycl::range<1>(in_size)};
+  q.submit([&](sycl::handler& cgh) {
+    auto acc = heads.get_access<sycl::access::mode::discard_write>(cgh);
+    cgh.fill(acc, 0);
+  });
+
+  q.submit([&](sycl::handler& cgh) {
+    auto starts = offsets.get_access<sycl::access::mode::read>(cgh);
+    auto flags = heads.get_access<sycl::access::mode::write>(cgh);
+
+    cgh.parallel_for<kernel_name<T, Op, offsets_to_heads<K>>>(
+        sycl::range<1>(n_segments), [=](sycl::item<1> item) {
+          /* Empty segments share their start with the next segment, which
+           * writes the same flag. */
+          size_t start = starts[item];
+          if (start < in_size) {
+            flags[start] = 1;
+          }
+        });
+  });
+
+  par_segmented_scan<T, Op, K>(in, heads, out, q, id, type, algorithm);
+}
+
+// Offset-based segmented scan using the identity from `identity<T, Op>`.
+template <typename T, typename Op,
+          size_t K = scan_items_per_work_item<segmented_value<T>>::value>
+void par_segmented_scan_offsets(
+    sycl::buffer<T, 1>& in, sycl::buffer<size_t, 1>& offsets,
+    sycl::buffer<T, 1>& out, sycl::queue& q,
+    scan_type type = scan_type::inclusive,
+    scan_algorithm algorithm = scan_algorithm::automatic) {
+  par_segmented_scan_offsets<T, Op, K>(in, offsets, out, q,
+                                       identity<T, Op>::value, type, algorithm);
+}
+
+// Kinds of memory a compaction works on, for kernel names.
+struct buffer_memory {};
+struct usm_memory {};
+
+/* Name the kernels of a compaction for each blocking, kind of memory and type
+ * of output and count. The predicate is part of the kernel name as well. */
+template <size_t K, bool Partition, typename Memory, typename Out,
+          typename Count>
+class scan_compact;
+
+template <size_t K, bool Partition, typename Memory, typename Out,
+          typename Count>
+class compact_empty;
+
+template <size_t K, typename Memory, typename Out, typename Count>
+class partition_reverse;
+
+template <typename P>
+struct compact_memory {
+  using type = buffer_memory;
+};
+
+template <typename T>
+struct compact_memory<T*> {
+  using type = usm_memory;
+};
+
+template <typename T>
+struct compact_memory<const T*> {
+  using type = usm_memory;
+};
+
+/* Binds the memory of a compaction to its command group. Buffers are accessed
+ * through accessors. USM pointers are wrapped, since kernels cannot capture
+ * raw pointers. */
+template <typename T>
+auto compact_input(sycl::handler& cgh, sycl::buffer<T, 1>& buf) {
+  return buf.template get_access<sycl::access::mode::read>(cgh);
+}
+
+template <typename T>
+sycl::experimental::usm_wrapper<T> compact_input(sycl::handler&,
+                                                 const T* ptr) {
+  return const_cast<T*>(ptr);
+}
+
+template <sycl::access::mode Mode, typename T>
+auto compact_output(sycl::handler& cgh, sycl::buffer<T, 1>& buf) {
+  return buf.template get_access<Mode>(cgh);
+}
+
+template <sycl::access::mode Mode, typename T>
+sycl::experimental::usm_wrapper<T> compact_output(sycl::handler&, T* ptr) {
+  return ptr;
+}
+
+/* Moves the `n` elements of `in` for which `pred` equals `keep` to the front
+ * of `out`, in order, and writes their number to `count[0]`. If `Partition`
+ * is set, the other elements follow them in `out`, also in order, and the
+ * previous contents of `out` are discarded; otherwise the elements of `out`
+ * past the selected ones are kept. `in`, `out`
+ * and `count` are buffers or USM device pointers; `out` must hold `n`
+ * elements for a partition and enough for the selected ones otherwise. The
+ * tile state comes from `workspace`, which must hold at least `n` elements
+ * and outlives the kernels, so nothing here waits for them.
+ *
+ * This is the blocked look-back scan with the predicate fused into its load
+ * phase and the scatter into its final phase: each work-item tests `K`
+ * elements in registers, the number of selected elements is scanned across
+ * the work-group and the tiles, and every element is read once and written
+ * once. A partition writes the rejected elements from the back of `out` and
+ * then reverses them with a second kernel, which reads and writes them again.
+ * Returns the event of the last kernel, after which `count` is valid. */
+template <typename T, typename Pred, size_t K, bool Partition, typename In,
+          typename Out, typename Count>
+sycl::event par_compact(sycl::queue& q, In& in, size_t n, Out& out,
+                        Count& count, Pred pred, bool keep,
+                        scan_workspace<size_t>& workspace,
+                        const std::vector<sycl::event>& deps) {
+  static_assert(K > 0, "Each work-item needs at least one element.");
+  if (workspace.capacity() < n) {
+    throw std::runtime_error(
+        "Compaction input exceeds the workspace capacity.");
+  }
+  using memory = typename compact_memory<typename std::decay<In>::type>::type;
+  using out_type = typename std::decay<Out>::type;
+  using count_type = typename std::decay<Count>::type;
+  constexpr auto out_mode = Partition ? sycl::access::mode::discard_write
+                                      : sycl::access::mode::write;
+
+  if (n == 0) {
+    return q.submit([&](sycl::handler& cgh) {
+      if (!deps.empty()) {
+        cgh.depends_on(deps);
+      }
+      auto total =
+          compact_output<sycl::access::mode::discard_write>(cgh, count);
+      cgh.single_task<kernel_name<
+          T, Pred, compact_empty<K, Partition, memory, out_type, count_type>>>(
+          [=]() { total[0] = 0; });
+    });
+  }
+
+  size_t wgroup_size = scan_wgroup_size<size_t>(q.get_device(), n, K);
+  size_t items = (n + K - 1) / K;
+  size_t n_tiles = (items + wgroup_size - 1) / wgroup_size;
+
+  look_back_state<size_t>& state = workspace.look_back(q);
+
+  auto event = q.submit([&](sycl::handler& cgh) {
+    if (!deps.empty()) {
+      cgh.depends_on(deps);
+    }
+    auto src = compact_input(cgh, in);
+    auto dst = compact_output<out_mode>(cgh, out);
+    auto total = compact_output<sycl::access::mode::discard_write>(cgh, count);
+    auto status =
+        state.flags.template get_access<sycl::access::mode::atomic>(cgh);
+    auto next_tile =
+        state.counter.template get_access<sycl::access::mode::atomic>(cgh);
+    auto tile_aggregates =
+        state.aggregates.template get_access<sycl::access::mode::read_write>(
+            cgh);
+    auto tile_inclusive =
+        state.inclusive.template get_access<sycl::access::mode::read_write>(
+            cgh);
+
+    sycl::accessor<size_t, 1, sycl::access::mode::read_write,
+                   sycl::access::target::local>
+        temp(wgroup_size, cgh);
+    sycl::accessor<int, 1, sycl::access::mode::read_write,
+                   sycl::access::target::local>
+        tile_id(1, cgh);
+    sycl::accessor<size_t, 1, sycl::access::mode::read_write,
+                   sycl::access::target::local>
+        tile_prefix_in(1, cgh);
+
+    cgh.parallel_for<kernel_name<
+        T, Pred, scan_compact<K, Partition, memory, out_type, count_type>>>(
+        sycl::nd_range<1>(n_tiles * wgroup_size, wgroup_size),
+        [=](sycl::nd_item<1> item) {
+          size_t lid = item.get_local_linear_id();
+
+          // Take the next tile in the order the work-groups started.
+          if (lid == 0) {
+            tile_id[0] = next_tile[0].fetch_add(1);
+          }
+          item.barrier(sycl::access::fence_space::local_space);
+
+          size_t tile = tile_id[0];
+          size_t first = (tile * wgroup_size + lid) * K;
+
+          // Load this work-item's elements and test them in registers.
+          T values[K];
+          bool selected[K];
+          size_t mine = 0;
+          for (size_t k = 0; k < K; k++) {
+            selected[k] = false;
+            if (first + k < n) {
+              values[k] = src[first + k];
+              selected[k] = static_cast<bool>(pred(values[k])) == keep;
+              mine += selected[k] ? 1 : 0;
+            }
+          }
+
+          // Exclusive scan of the per-item counts.
+          temp[lid] = mine;
+          scan_local<size_t, std::plus<size_t>>(item, temp, wgroup_size, 0);
+
+          // The last work-item holds the tile's count and looks back.
+          if (lid == wgroup_size - 1) {
+            size_t before = temp[lid];
+            size_t aggregate = before + mine;
+            size_t prefix = look_back<size_t, std::plus<size_t>>(
+                item, status, tile_aggregates, tile_inclusive, tile,
+                aggregate, size_t(0));
+            tile_prefix_in[0] = prefix;
+            if (tile == n_tiles - 1) {
+              total[0] = prefix + aggregate;
+            }
+          }
+          item.barrier(sycl::access::fence_space::local_space);
+
+          /* Scatter: selected elements go to their rank among the selected
+           * ones, rejected ones of a partition to their rank among the
+           * rejected ones, counted from the back. */
+          size_t prefix = tile_prefix_in[0];
+          size_t before = temp[lid];
+          size_t pos = prefix + before;
+          for (size_t k = 0; k < K; k++) {
+            if (first + k < n) {
+              if (selected[k]) {
+                dst[pos] = values[k];
+                pos++;
+              } else if (Partition) {
+                dst[n - 1 - (first + k - pos)] = values[k];
+              }
+            }
+          }
+        });
+  });
+
+  if constexpr (!Partition) {
+    return event;
+  }
+
+  // Restore the order of the rejected elements at the back of `out`.
+  return q.submit([&](sycl::handler& cgh) {
+    cgh.depends_on(event);
+    auto dst = compact_output<sycl::access::mode::read_write>(cgh, out);
+    auto total = compact_output<sycl::access::mode::read>(cgh, count);
+
+    cgh.parallel_for<kernel_name<
+        T, Pred, partition_reverse<K, memory, out_type, count_type>>>(
+        sycl::range<1>(n / 2), [=](sycl::item<1> item) {
+          size_t lo = total[0] + item.get_linear_id();
+          size_t hi = n - 1 - item.get_linear_id();
+          if (lo < hi) {
+            T value = dst[lo];
+            dst[lo] = dst[hi];
+            dst[hi] = value;
+          }
+        });
+  });
+}
+
+/* Copies the elements of `in` for which `pred` is true to the front of `out`,
+ * in order, and writes their number to `count[0]` on the device. `Pred` names
+ * the kernel, so it has to be a function object type rather than a lambda.
+ * Tile state comes from `workspace`, so the call returns without waiting. */
+template <typename T, typename Pred,
+          size_t K = scan_items_per_work_item<T>::value>
+sycl::event par_copy_if(sycl::queue& q, sycl::buffer<T, 1>& in,
+                        sycl::buffer<T, 1>& out,
+                        sycl::buffer<size_t, 1>& count, Pred pred,
+                        scan_workspace<size_t>& workspace) {
+  return par_compact<T, Pred, K, false>(q, in, in.get_count(), out, count, pred,
+                                        true, workspace, {});
+}
+
+// Copies the `n` elements at the USM device pointer `in` where `pred` holds.
+template <typename T, typename Pred,
+          size_t K = scan_items_per_work_item<T>::value>
+sycl::event par_copy_if(sycl::queue& q, const T* in, size_t n, T* out,
+                        size_t* count, Pred pred,
+                        scan_workspace<size_t>& workspace,
+                        const std::vector<sycl::event>& deps = {}) {
+  return par_compact<T, Pred, K, false>(q, in, n, out, count, pred,
+                                        true, workspace, deps);
+}
+
+/* Copies the elements of `in` for which `pred` is false to the front of `out`,
+ * in order, and writes their number to `count[0]` on the device. */
+template <typename T, typename Pred,
+          size_t K = scan_items_per_work_item<T>::value>
+sycl::event par_remove_if(sycl::queue& q, sycl::buffer<T, 1>& in,
+                          sycl::buffer<T, 1>& out,
+                          sycl::buffer<size_t, 1>& count, Pred pred,
+                          scan_workspace<size_t>& workspace) {
+  return par_compact<T, Pred, K, false>(q, in, in.get_count(), out, count, pred,
+                                        false, workspace, {});
+}
+
+// Removes the `n` elements at the USM device pointer `in` where `pred` holds.
+template <typename T, typename Pred,
+          size_t K = scan_items_per_work_item<T>::value>
+sycl::event par_remove_if(sycl::queue& q, const T* in, size_t n, T* out,
+                          size_t* count, Pred pred,
+                          scan_workspace<size_t>& workspace,
+                          const std::vector<sycl::event>& deps = {}) {
+  return par_compact<T, Pred, K, false>(q, in, n, out, count, pred,
+                                        false, workspace, deps);
+}
+
+/* Stable partition of `in` into `out`, which has the same size: the elements
+ * for which `pred` is true come first, followed by the others, each in their
+ * original order. The number of true elements is written to `count[0]`. */
+template <typename T, typename Pred,
+          size_t K = scan_items_per_work_item<T>::value>
+sycl::event par_partition(sycl::queue& q, sycl::buffer<T, 1>& in,
+                          sycl::buffer<T, 1>& out,
+                          sycl::buffer<size_t, 1>& count, Pred pred,
+                          scan_workspace<size_t>& workspace) {
+  if (in.get_count() != out.get_count()) {
+    throw std::runtime_error("Partition input and output sizes differ.");
+  }
+  return par_compact<T, Pred, K, true>(q, in, in.get_count(), out, count, pred,
+                                       true, workspace, {});
+}
+
+// Stable partition of the `n` elements at the USM device pointer `in`.
+template <typename T, typename Pred,
+          size_t K = scan_items_per_work_item<T>::value>
+sycl::event par_partition(sycl::queue& q, const T* in, size_t n, T* out,
+                          size_t* count, Pred pred,
+                          scan_workspace<size_t>& workspace,
+                          const std::vector<sycl::event>& deps = {}) {
+  return par_compact<T, Pred, K, true>(q, in, n, out, count, pred,
+                                       true, workspace, deps);
+}
+
+#endif  // SCAN_HPP
@@ -0,0 +1,121 @@
+/***************************************************************************
+ *
+ *  Copyright (C) 2017 Codeplay Software Limited
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  For your convenience, a copy of the License has been included in this
+ *  repository.
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  Codeplay's ComputeCpp SDK
+ *
+ *  scan_benchmark.cpp
+ *
+ *  Description:
+ *    Compares the recursive, the single-pass look-back and the blocked scans
+ *    of scan.hpp on the host and CPU devices.
+ *
+ **************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "scan.hpp"
+
+/* Runs `iterations` scans of `in` with the given algorithm on q and returns the
+ * average time per scan in milliseconds, or a negative value if a result is
+ * wrong. Each run copies the input into a fresh buffer, which is not timed. */
+double time_scan(sycl::queue& q, const std::vector<int32_t>& in,
+                 const std::vector<int32_t>& expected, scan_algorithm algorithm,
+                 int iterations) {
+  double total = 0.0;
+  std::vector<int32_t> out(in.size());
+
+  // The first run builds the kernels and is not timed.
+  for (int i = -1; i < iterations; i++) {
+    {
+      sycl::buffer<int32_t, 1> buf(sycl::range<1>(in.size()));
+      buf.set_final_data(out.data());
+      q.submit([&](sycl::handler& cgh) {
+        auto acc = buf.get_access<sycl::access::mode::discard_write>(cgh);
+        cgh.copy(in.data(), acc);
+      });
+      q.wait();
+
+      auto start = std::chrono::steady_clock::now();
+      par_scan<int32_t, std::plus<int32_t>>(buf, q, algorithm);
+      q.wait();
+      auto end = std::chrono::steady_clock::now();
+
+      if (i >= 0) {
+        total += std::chrono::duration<double, std::milli>(end - start).count();
+      }
+    }
+
+    if (out != expected) {
+      return -1.0;
+    }
+  }
+
+  return total / iterations;
+}
+
+/* Times every scan algorithm on q. The single-pass scans need a device with
+ * forward progress between work-groups and are skipped otherwise. */
+void compare_scans(sycl::queue& q, const std::vector<int32_t>& in,
+                   const std::vector<int32_t>& expected, int iterations) {
+  double recursive =
+      time_scan(q, in, expected, scan_algorithm::recursive, iterations);
+  std::cout << "  recursive: " << recursive << " ms\n";
+
+  if (!has_forward_progress(q.get_device())) {
+    std::cout << "  look-back: no forward-progress guarantee\n";
+    return;
+  }
+
+  double look_back =
+      time_scan(q, in, expected, scan_algorithm::look_back, iterations);
+  std::cout << "  look-back: " << look_back << " ms\n";
+
+  double blocked =
+      time_scan(q, in, expected, scan_algorithm::blocked, iterations);
+  std::cout << "  blocked:   " << blocked << " ms\n";
+}
+
+/* usage: ./scan_benchmark [elements] [iterations] */
+int main(int argc, char* argv[]) {
+  size_t size = (argc > 1) ? std::stoul(argv[1]) : 65536u;
+  int iterations = (argc > 2) ? std::stoi(argv[2]) : 5;
+
+  // Small values keep the sum within int32_t.
+  std::vector<int32_t> in(size);
+  for (size_t i = 0; i < size; i++) {
+    in[i] = static_cast<int32_t>(i % 7);
+  }
+
+  std::vector<int32_t> expected(size);
+  std::partial_sum(in.begin(), in.end(), expected.begin());
+
+  std::cout << "Elements: " << size << ", iterations: " << iterations << '\n';
+  auto scans = [&](sycl::queue& q) {
+    compare_scans(q, in, expected, iterations);
+  };
+  time_on("Host", sycl::host_selector{}, scans);
+  time_on("CPU", sycl::cpu_selector{}, scans);
+
+  return 0;
+}